@@ -1,22 +1,31 @@
 #include "apu.h"
+#include "state.h"
 #include <cmath>
 #include <algorithm>
 
 APU::APU() {
     pulse1.isChannel1 = true;
     pulse2.isChannel1 = false;
-    sampleBuffer.fill(0.0f);
+}
+
+// A divider counting down from `period`: run it `ticks` ticks in one go and
+// return how many times it reloaded
+static uint32_t runTimer(uint16_t& value, uint16_t period, uint32_t ticks) {
+    if (ticks <= value) {
+        value = (uint16_t)(value - ticks);
+        return 0;
+    }
+    uint32_t after = ticks - value - 1; // ticks left after the first reload
+    value = (uint16_t)(period - after % (period + 1u));
+    return 1 + after / (period + 1u);
 }
 
 // ===================== Pulse =====================
 
-void APU::Pulse::clockTimer() {
-    if (timerValue == 0) {
-        timerValue = timerPeriod;
-        dutyPos = (dutyPos + 1) & 7;
-    } else {
-        timerValue--;
-    }
+uint32_t APU::Pulse::clockTimer(uint32_t ticks) {
+    uint32_t steps = runTimer(timerValue, timerPeriod, ticks);
+    dutyPos = (uint8_t)((dutyPos + steps) & 7);
+    return steps;
 }
 
 void APU::Pulse::clockEnvelope() {
@@ -69,6 +78,11 @@ void APU::Pulse::clockSweep() {
     }
 }
 
+bool APU::Pulse::audible() const {
+    return enabled && lengthCounter > 0 && timerPeriod >= 8 && sweepTarget() <= 0x7FF &&
+           (constantVolume ? envelopeVolume : envelopeDecay) > 0;
+}
+
 uint8_t APU::Pulse::output() const {
     if (!enabled) return 0;
     if (lengthCounter == 0) return 0;
@@ -80,15 +94,13 @@ uint8_t APU::Pulse::output() const {
 
 // ===================== Triangle =====================
 
-void APU::Triangle::clockTimer() {
-    if (timerValue == 0) {
-        timerValue = timerPeriod;
-        if (lengthCounter > 0 && linearCounter > 0) {
-            sequencePos = (sequencePos + 1) & 31;
-        }
-    } else {
-        timerValue--;
+uint32_t APU::Triangle::clockTimer(uint32_t ticks) {
+    uint32_t steps = runTimer(timerValue, timerPeriod, ticks);
+    if (lengthCounter > 0 && linearCounter > 0) {
+        sequencePos = (uint8_t)((sequencePos + steps) & 31);
+        return steps;
     }
+    return 0;
 }
 
 void APU::Triangle::clockLinearCounter() {
@@ -108,6 +120,11 @@ void APU::Triangle::clockLengthCounter() {
     }
 }
 
+bool APU::Triangle::audible() const {
+    // Ultrasonic output is held at 7
+    return enabled && lengthCounter > 0 && linearCounter > 0 && timerPeriod >= 2;
+}
+
 uint8_t APU::Triangle::output() const {
     if (!enabled) return 0;
     if (lengthCounter == 0) return 0;
@@ -118,15 +135,26 @@ uint8_t APU::Triangle::output() const {
 
 // ===================== Noise =====================
 
-void APU::Noise::clockTimer() {
-    if (timerValue == 0) {
-        timerValue = timerPeriod;
-        uint8_t bit = mode ? 6 : 1;
-        uint16_t feedback = (shiftReg & 1) ^ ((shiftReg >> bit) & 1);
-        shiftReg = (shiftReg >> 1) | (feedback << 14);
-    } else {
-        timerValue--;
+uint32_t APU::Noise::clockTimer(uint32_t ticks) {
+    uint32_t steps = runTimer(timerValue, timerPeriod, ticks);
+
+    // Feedback taps bits 0 and `tap` of the 15-bit register, and new bits
+    // enter at bit 14, so the next 15 - tap feedback bits come straight from
+    // the current register: that many shifts are done in one go.
+    int tap = mode ? 6 : 1;
+    int batch = 15 - tap;
+    uint32_t reg = shiftReg;
+    uint32_t left = steps;
+    for (; left >= (uint32_t)batch; left -= batch) {
+        uint32_t feedback = (reg ^ (reg >> tap)) & ((1u << batch) - 1);
+        reg = (reg >> batch) | (feedback << tap);
+    }
+    for (; left > 0; left--) {
+        uint32_t feedback = (reg ^ (reg >> tap)) & 1;
+        reg = (reg >> 1) | (feedback << 14);
     }
+    shiftReg = (uint16_t)reg;
+    return steps;
 }
 
 void APU::Noise::clockEnvelope() {
@@ -154,6 +182,10 @@ void APU::Noise::clockLengthCounter() {
     }
 }
 
+bool APU::Noise::audible() const {
+    return enabled && lengthCounter > 0 && (constantVolume ? envelopeVolume : envelopeDecay) > 0;
+}
+
 uint8_t APU::Noise::output() const {
     if (!enabled) return 0;
     if (lengthCounter == 0) return 0;
@@ -164,6 +196,7 @@ uint8_t APU::Noise::output() const {
 // ===================== Frame Counter =====================
 
 void APU::clockQuarterFrame() {
+    levelDirty = true;
     pulse1.clockEnvelope();
     pulse2.clockEnvelope();
     triangle.clockLinearCounter();
@@ -171,6 +204,7 @@ void APU::clockQuarterFrame() {
 }
 
 void APU::clockHalfFrame() {
+    levelDirty = true;
     pulse1.clockLengthCounter();
     pulse1.clockSweep();
     pulse2.clockLengthCounter();
@@ -181,31 +215,34 @@ void APU::clockHalfFrame() {
 
 // ===================== Mixing =====================
 
-float APU::mix() const {
-    // Linear approximation mixing (good enough, avoids lookup table)
-    uint8_t p1 = pulse1.output();
-    uint8_t p2 = pulse2.output();
-    uint8_t tri = triangle.output();
-    uint8_t noi = noise.output();
-    uint8_t dm = dmc.output_level;
-
-    float pulseOut = 0.0f;
-    if (p1 || p2) {
-        pulseOut = 95.88f / (8128.0f / (float)(p1 + p2) + 100.0f);
+// The usual lookup-table approximation of the nonlinear mixer, in
+// BlipBuffer fixed point: pulse by p1 + p2, the rest by 3*tri + 2*noise + dmc
+static const auto pulseTable = [] {
+    std::array<int, 31> t{};
+    for (int n = 1; n < 31; n++) {
+        t[n] = (int)std::lround(95.52 / (8128.0 / n + 100.0) * BlipBuffer::LEVEL_ONE);
     }
+    return t;
+}();
 
-    float tndOut = 0.0f;
-    float tndSum = tri / 8227.0f + noi / 12241.0f + dm / 22638.0f;
-    if (tndSum > 0.0f) {
-        tndOut = 159.79f / (1.0f / tndSum + 100.0f);
+static const auto tndTable = [] {
+    std::array<int, 203> t{};
+    for (int n = 1; n < 203; n++) {
+        t[n] = (int)std::lround(163.67 / (24329.0 / n + 100.0) * BlipBuffer::LEVEL_ONE);
     }
+    return t;
+}();
 
-    return pulseOut + tndOut;
+int APU::mix() const {
+    int pulse = pulse1.output() + pulse2.output();
+    int tnd = 3 * triangle.output() + 2 * noise.output() + dmc.output_level;
+    return pulseTable[pulse] + tndTable[tnd];
 }
 
 // ===================== Register Writes =====================
 
 void APU::cpuWrite(uint16_t addr, uint8_t val) {
+    levelDirty = true;
     switch (addr) {
         // Pulse 1: $4000-$4003
         case 0x4000:
@@ -339,83 +376,153 @@ uint8_t APU::cpuRead(uint16_t addr) {
 
 // ===================== Clock =====================
 
-void APU::clock() {
-    // Triangle clocks at CPU rate
-    triangle.clockTimer();
-
-    // Pulse and noise clock at half CPU rate
-    if (cpuClock % 2 == 0) {
-        pulse1.clockTimer();
-        pulse2.clockTimer();
-        noise.clockTimer();
-
-        // Frame counter (clocked at ~240Hz, every 3728.5 CPU half-clocks ≈ 7457 CPU clocks)
-        frameClock++;
-        if (frameCounterMode == 0) {
-            // 4-step sequence
-            switch (frameClock) {
-                case 3729:  clockQuarterFrame(); break;
-                case 7457:  clockQuarterFrame(); clockHalfFrame(); break;
-                case 11186: clockQuarterFrame(); break;
-                case 14915:
-                    clockQuarterFrame(); clockHalfFrame();
-                    if (!inhibitIRQ) frameIRQ = true;
-                    frameClock = 0;
-                    break;
-            }
-        } else {
-            // 5-step sequence
-            switch (frameClock) {
-                case 3729:  clockQuarterFrame(); break;
-                case 7457:  clockQuarterFrame(); clockHalfFrame(); break;
-                case 11186: clockQuarterFrame(); break;
-                case 14915: break; // do nothing
-                case 18641:
-                    clockQuarterFrame(); clockHalfFrame();
-                    frameClock = 0;
-                    break;
-            }
+// Frame counter steps, in half-rate ticks (≈ 7457 CPU clocks per quarter)
+static constexpr int stepTicks[2][5] = {
+    { 3729, 7457, 11186, 14915, 14915 }, // 4-step
+    { 3729, 7457, 11186, 14915, 18641 }, // 5-step
+};
+
+uint32_t APU::ticksToFrameStep() const {
+    for (int next : stepTicks[frameCounterMode]) {
+        if (next > frameClock) return (uint32_t)(next - frameClock);
+    }
+    return UINT32_MAX;
+}
+
+void APU::clockFrameCounter() {
+    if (frameCounterMode == 0) {
+        // 4-step sequence
+        switch (frameClock) {
+            case 3729:  clockQuarterFrame(); break;
+            case 7457:  clockQuarterFrame(); clockHalfFrame(); break;
+            case 11186: clockQuarterFrame(); break;
+            case 14915:
+                clockQuarterFrame(); clockHalfFrame();
+                if (!inhibitIRQ) frameIRQ = true;
+                frameClock = 0;
+                break;
         }
+    } else {
+        // 5-step sequence
+        switch (frameClock) {
+            case 3729:  clockQuarterFrame(); break;
+            case 7457:  clockQuarterFrame(); clockHalfFrame(); break;
+            case 11186: clockQuarterFrame(); break;
+            case 14915: break; // do nothing
+            case 18641:
+                clockQuarterFrame(); clockHalfFrame();
+                frameClock = 0;
+                break;
+        }
+    }
+}
+
+// Cycles up to and including the next one where something happens
+uint64_t APU::cyclesToNextStop(uint64_t limit) const {
+    uint64_t stop = std::min(limit, cyclesToTick(ticksToFrameStep() - 1));
+    if (!output) return stop;
+
+    // The mix changed outside a timer step: pick it up on the next cycle
+    if (levelDirty) return 1;
+    stop = std::min(stop, (uint64_t)(BlipBuffer::MAX_FRAME_CLOCKS - blipClock));
+
+    // Steps of silent channels don't change the mix, so they don't stop
+    if (triangle.audible()) stop = std::min(stop, (uint64_t)triangle.timerValue + 1);
+    if (pulse1.audible()) stop = std::min(stop, cyclesToTick(pulse1.timerValue));
+    if (pulse2.audible()) stop = std::min(stop, cyclesToTick(pulse2.timerValue));
+    if (noise.audible()) stop = std::min(stop, cyclesToTick(noise.timerValue));
+    return stop;
+}
+
+// Everything in `cycles` is a timer tick: no frame-counter step before the
+// last cycle and, with output on, no audible step before it either
+void APU::advance(uint64_t cycles) {
+    uint32_t ticks = ticksIn(cycles);
+    bool audibleStep = false;
+    audibleStep |= triangle.clockTimer((uint32_t)cycles) && triangle.audible();
+    audibleStep |= pulse1.clockTimer(ticks) && pulse1.audible();
+    audibleStep |= pulse2.clockTimer(ticks) && pulse2.audible();
+    audibleStep |= noise.clockTimer(ticks) && noise.audible();
+    if (audibleStep) levelDirty = true;
+
+    cpuClock += cycles;
+    if (ticks > 0) {
+        frameClock += (int)ticks;
+        clockFrameCounter();
+    }
+}
+
+void APU::run(uint64_t cycles) {
+    while (cycles > 0) {
+        uint64_t step = cyclesToNextStop(cycles);
+        advance(step);
+        cycles -= step;
+        if (!output) continue;
+
+        blipClock += (uint32_t)step;
+        if (levelDirty) {
+            // The mix as it stands after the last cycle's timers and step
+            levelDirty = false;
+            blip.setLevel(blipClock - 1, mix());
+        }
+        if (blipClock == BlipBuffer::MAX_FRAME_CLOCKS) flushSamples();
     }
+}
 
-    // Accumulate mix output for sample averaging
-    sampleSum += mix();
-    sampleCount++;
-
-    // Generate sample at output sample rate
-    sampleAccumulator += SAMPLES_PER_CPU_CLOCK;
-    if (sampleAccumulator >= 1.0) {
-        sampleAccumulator -= 1.0;
-
-        // Average all APU outputs since the last output sample
-        float sample = (sampleCount > 0)
-            ? (float)(sampleSum / sampleCount)
-            : prevSample;
-        sampleSum = 0.0;
-        sampleCount = 0;
-
-        // First-order low-pass filter to remove aliasing hiss
-        sample = LPF_ALPHA * sample + (1.0f - LPF_ALPHA) * prevSample;
-        prevSample = sample;
-
-        std::lock_guard<std::mutex> lock(bufferMutex);
-        sampleBuffer[sampleWritePos] = sample;
-        sampleWritePos = (sampleWritePos + 1) % BUFFER_SIZE;
+void APU::flushSamples() {
+    if (blipClock == 0) return;
+    int count = blip.endFrame(blipClock, frameSamples.data());
+    blipClock = 0;
+    size_t taken = ring.push(frameSamples.data(), count);
+    if (taken < (size_t)count) {
+        overflowed.fetch_add(count - taken, std::memory_order_relaxed);
     }
+    if (targetFill > 0) steerRate();
+}
+
+void APU::setTargetFill(int samples) {
+    targetFill = std::clamp(samples, 0, BUFFER_SIZE - BlipBuffer::MAX_SAMPLES);
+    averageFill = targetFill;
+    fillIntegral = 0.0;
+    skew = 0.0;
+    blip.setRates(CPU_CLOCK, SAMPLE_RATE);
+}
 
-    cpuClock++;
+void APU::steerRate() {
+    // PI controller on the ring level. The proportional term reacts to
+    // jitter within a few frames; the integral term cancels a steady clock
+    // mismatch (the sound card's crystal, or frame pacing that doesn't hold
+    // the NES's 60.1 Hz exactly) so the level ends up on target instead of
+    // offset from it.
+    averageFill += ((double)ring.size() - averageFill) * 0.1;
+    double error = std::clamp((targetFill - averageFill) / targetFill, -1.0, 1.0);
+    fillIntegral = std::clamp(fillIntegral + error * 0.002, -1.0, 1.0);
+    skew = MAX_RATE_SKEW * std::clamp(2.0 * error + fillIntegral, -1.0, 1.0);
+    blip.setRates(CPU_CLOCK, SAMPLE_RATE * (1.0 + skew));
 }
 
 void APU::fillBuffer(float* buffer, int numSamples) {
-    std::lock_guard<std::mutex> lock(bufferMutex);
-    for (int i = 0; i < numSamples; i++) {
-        if (sampleReadPos != sampleWritePos) {
-            lastOutputSample = sampleBuffer[sampleReadPos] * 0.5f; // master volume
-            buffer[i] = lastOutputSample;
-            sampleReadPos = (sampleReadPos + 1) % BUFFER_SIZE;
-        } else {
-            // Repeat last sample instead of silence to avoid pops
-            buffer[i] = lastOutputSample;
-        }
+    int got = (int)ring.pop(buffer, numSamples);
+    for (int i = 0; i < got; i++) buffer[i] *= 0.5f; // master volume
+    if (got > 0) lastOutputSample = buffer[got - 1];
+    if (got < numSamples) {
+        // Repeat last sample instead of silence to avoid pops
+        std::fill(buffer + got, buffer + numSamples, lastOutputSample);
+        underran.fetch_add(numSamples - got, std::memory_order_relaxed);
     }
 }
+
+// ===================== Save States =====================
+
+void APU::saveState(StateWriter& w) const {
+    w.pod(frameCounterMode); w.pod(frameIRQ); w.pod(inhibitIRQ); w.pod(frameClock);
+    w.pod(pulse1); w.pod(pulse2); w.pod(triangle); w.pod(noise); w.pod(dmc);
+    w.pod(cpuClock);
+}
+
+void APU::loadState(StateReader& r) {
+    r.pod(frameCounterMode); r.pod(frameIRQ); r.pod(inhibitIRQ); r.pod(frameClock);
+    r.pod(pulse1); r.pod(pulse2); r.pod(triangle); r.pod(noise); r.pod(dmc);
+    r.pod(cpuClock);
+    levelDirty = true;
+}
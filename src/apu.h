@@ -1,8 +1,13 @@
 #pragma once
 #include <cstdint>
 #include <array>
+#include <atomic>
 #include <vector>
-#include <mutex>
+#include "blip.h"
+#include "spsc.h"
+
+class StateWriter;
+class StateReader;
 
 class APU {
 public:
@@ -11,16 +16,49 @@ public:
     void cpuWrite(uint16_t addr, uint8_t val);
     uint8_t cpuRead(uint16_t addr);
 
-    // Called at CPU rate (~1.789 MHz)
-    void clock();
+    // Advance by `cycles` CPU cycles (~1.789 MHz). Timers jump in closed
+    // form; the work done scales with frame-counter steps and, with output
+    // on, audible waveform steps, not with the cycle count.
+    void run(uint64_t cycles);
 
-    // Fill audio buffer for SDL callback
+    // Fill audio buffer for SDL callback (the ring's consumer)
     void fillBuffer(float* buffer, int numSamples);
 
+    // Turn the level changes since the last call into samples and publish
+    // them to the audio thread in one batch. Console::runFrame calls this once
+    // per frame; run() calls it itself if nobody has for too long.
+    void flushSamples();
+
+    // Monitoring, readable from any thread: samples dropped because the ring
+    // was full, and samples the callback had to pad because it was empty
+    uint64_t overflowSamples() const { return overflowed.load(std::memory_order_relaxed); }
+    uint64_t underrunSamples() const { return underran.load(std::memory_order_relaxed); }
+    size_t queuedSamples() const { return ring.size(); }
+
+    // Dynamic rate control: with a target set, flushSamples() steers the
+    // resampling ratio (by at most MAX_RATE_SKEW, far below audible pitch
+    // change) so the ring settles at `samples` queued. That absorbs the drift
+    // between the emulated clock, video pacing and the sound card's clock,
+    // and fixes the audio latency. 0 (the default) resamples at exactly
+    // SAMPLE_RATE.
+    void setTargetFill(int samples);
+    double rateSkew() const { return skew; } // current ratio adjustment, e.g. -0.001
+
+    static constexpr double MAX_RATE_SKEW = 0.005;
+
+    // With output off (run-ahead's hidden frames) no samples are produced
+    void setOutputEnabled(bool on) { output = on; }
+    bool outputEnabled() const { return output; }
+
     // Sample rate
     static constexpr int SAMPLE_RATE = 44100;
     static constexpr double CPU_CLOCK = 1789773.0;
 
+    // Save states (layout in state.h). Samples already queued for the audio
+    // callback are not part of the state.
+    void saveState(StateWriter& w) const;
+    void loadState(StateReader& r);
+
 private:
     // Frame counter
     uint8_t frameCounterMode = 0; // 0 = 4-step, 1 = 5-step
@@ -67,12 +105,13 @@ private:
         uint8_t sweepDivider = 0;
         bool isChannel1 = false; // for negate difference
 
-        void clockTimer();
+        uint32_t clockTimer(uint32_t ticks); // returns waveform steps taken
         void clockEnvelope();
         void clockLengthCounter();
         void clockSweep();
         uint8_t output() const;
         uint16_t sweepTarget() const;
+        bool audible() const; // whether a waveform step can change output()
     };
 
     Pulse pulse1, pulse2;
@@ -101,10 +140,11 @@ private:
             0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15
         };
 
-        void clockTimer();
+        uint32_t clockTimer(uint32_t ticks);
         void clockLinearCounter();
         void clockLengthCounter();
         uint8_t output() const;
+        bool audible() const;
     };
 
     Triangle triangle;
@@ -133,10 +173,11 @@ private:
         uint8_t envelopeDecay = 0;
         uint8_t envelopeDivider = 0;
 
-        void clockTimer();
+        uint32_t clockTimer(uint32_t ticks);
         void clockEnvelope();
         void clockLengthCounter();
         uint8_t output() const;
+        bool audible() const;
     };
 
     Noise noise;
@@ -162,31 +203,40 @@ private:
     // Frame counter
     void clockQuarterFrame();
     void clockHalfFrame();
+    uint32_t ticksToFrameStep() const;
+    void clockFrameCounter(); // the step frameClock has just reached
 
-    // Mixing
-    float mix() const;
-
-    // Sample buffer for audio thread
-    static constexpr int BUFFER_SIZE = 8192;
-    std::array<float, BUFFER_SIZE> sampleBuffer{};
-    int sampleWritePos = 0;
-    int sampleReadPos = 0;
-    std::mutex bufferMutex;
-
-    // Sampling
-    double sampleAccumulator = 0.0;
-    static constexpr double SAMPLES_PER_CPU_CLOCK = SAMPLE_RATE / CPU_CLOCK;
-
-    // Sample averaging to reduce aliasing
-    double sampleSum = 0.0;
-    int sampleCount = 0;
+    // Half-rate ticks (pulse, noise, frame counter) fall on even cycles
+    uint32_t ticksIn(uint64_t cycles) const { return (uint32_t)((cycles + 1 - (cpuClock & 1)) / 2); }
+    uint64_t cyclesToTick(uint32_t tick) const { return (cpuClock & 1) + 2 * (uint64_t)tick + 1; }
+    uint64_t cyclesToNextStop(uint64_t limit) const;
+    void advance(uint64_t cycles);
 
-    // Low-pass filter state
-    float prevSample = 0.0f;
-    static constexpr float LPF_ALPHA = 0.65f;
+    // Mixed output of all channels, BlipBuffer::LEVEL_ONE = 1.0
+    int mix() const;
 
-    // Last valid output for underrun interpolation
+    // Samples for the audio thread; the emulation thread is the only producer
+    static constexpr int BUFFER_SIZE = 8192;
+    SpscRing<float, BUFFER_SIZE> ring;
+    std::array<float, BlipBuffer::MAX_SAMPLES> frameSamples{};
+    std::atomic<uint64_t> overflowed{0};
+    std::atomic<uint64_t> underran{0};
+
+    // Band-limited synthesis. Output-side like the ring, so not in the state.
+    BlipBuffer blip{CPU_CLOCK, SAMPLE_RATE};
+    uint32_t blipClock = 0;  // CPU cycles since the last flushSamples()
+    bool levelDirty = true;  // a channel may have changed its output
+
+    // Rate controller (emulation thread), see setTargetFill()
+    int targetFill = 0;
+    double averageFill = 0.0; // ring level smoothed over the callback's bursts
+    double fillIntegral = 0.0;
+    double skew = 0.0;
+    void steerRate();
+
+    // Last valid output for underrun interpolation (audio thread only)
     float lastOutputSample = 0.0f;
 
     uint64_t cpuClock = 0;
+    bool output = true;
 };
@@ -0,0 +1,98 @@
+#include "audio.h"
+#include "apu.h"
+
+#include <SDL3/SDL.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+
+bool AudioOutput::open(int latencyMs) {
+    close();
+    int target = std::max(1, latencyMs) * APU::SAMPLE_RATE / 1000;
+
+    // A quarter of the budget for the device buffer (a power of two SDL and
+    // most drivers take as is), the rest for the ring in front of it
+    int request = 64;
+    while (request * 2 <= target / 4 && request < 2048) request *= 2;
+    SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, std::to_string(request).c_str());
+
+    SDL_AudioSpec spec{};
+    spec.freq = APU::SAMPLE_RATE;
+    spec.format = SDL_AUDIO_F32;
+    spec.channels = 1;
+    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, callback, this);
+    if (!stream) {
+        std::cerr << "Warning: Audio init failed: " << SDL_GetError() << "\n";
+        return false;
+    }
+
+    // The driver may not have honoured the hint
+    SDL_AudioSpec deviceSpec{};
+    frames = request;
+    SDL_GetAudioDeviceFormat(SDL_GetAudioStreamDevice(stream), &deviceSpec, &frames);
+    scratch.assign((size_t)std::max(frames, request) * 2, 0.0f);
+
+    // The ring tops up once per video frame, so its level saws between the
+    // controller's set point (sampled right after the top-up) and one frame
+    // below it: aim the middle of that at what the device leaves of the
+    // budget, but never so low that it runs dry before the next frame
+    int perFrame = APU::SAMPLE_RATE / 60;
+    apu.setTargetFill(std::max(target - frames + perFrame / 2, perFrame + frames));
+
+    latency = 0.0; jitter = 0.0; maxJitter = 0.0;
+    underruns = 0; callbacks = 0;
+    lastCallback = 0;
+    SDL_ResumeAudioStreamDevice(stream);
+    return true;
+}
+
+void AudioOutput::close() {
+    if (!stream) return;
+    SDL_DestroyAudioStream(stream);
+    stream = nullptr;
+    apu.setTargetFill(0);
+}
+
+void AudioOutput::callback(void* userdata, SDL_AudioStream* stream, int additional, int /*total*/) {
+    auto* self = static_cast<AudioOutput*>(userdata);
+    int samples = additional / (int)sizeof(float);
+    if (samples > 0) self->feed(stream, samples);
+}
+
+void AudioOutput::feed(SDL_AudioStream* s, int samples) {
+    uint64_t now = SDL_GetTicksNS();
+    if (lastCallback != 0) {
+        double periodMs = 1000.0 * frames / APU::SAMPLE_RATE;
+        double deviation = std::abs((now - lastCallback) / 1e6 - periodMs);
+        jitter.store(jitter.load(std::memory_order_relaxed) * 0.95 + deviation * 0.05,
+                     std::memory_order_relaxed);
+        if (deviation > maxJitter.load(std::memory_order_relaxed)) {
+            maxJitter.store(deviation, std::memory_order_relaxed);
+        }
+    }
+    lastCallback = now;
+
+    // What's queued ahead of the speaker when this request is answered
+    int queued = (int)apu.queuedSamples() + SDL_GetAudioStreamQueued(s) / (int)sizeof(float) + frames;
+    double ms = 1000.0 * queued / APU::SAMPLE_RATE;
+    double average = latency.load(std::memory_order_relaxed);
+    latency.store(average == 0.0 ? ms : average * 0.95 + ms * 0.05, std::memory_order_relaxed);
+
+    if (apu.queuedSamples() < (size_t)samples) underruns.fetch_add(1, std::memory_order_relaxed);
+
+    // Normally one device period; larger requests go through in pieces
+    while (samples > 0) {
+        int n = std::min(samples, (int)scratch.size());
+        apu.fillBuffer(scratch.data(), n);
+        SDL_PutAudioStreamData(s, scratch.data(), n * (int)sizeof(float));
+        samples -= n;
+    }
+    callbacks.fetch_add(1, std::memory_order_relaxed);
+}
+
+AudioOutput::Stats AudioOutput::stats() const {
+    return { latency.load(std::memory_order_relaxed), jitter.load(std::memory_order_relaxed),
+             maxJitter.load(std::memory_order_relaxed), underruns.load(std::memory_order_relaxed),
+             callbacks.load(std::memory_order_relaxed) };
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+class APU;
+struct SDL_AudioStream;
+
+// SDL playback for the APU's sample ring, sized for a target end-to-end
+// latency. The device buffer is picked from the target, the APU's rate
+// control holds the ring at what is left of it, and the callback only copies
+// through a buffer allocated up front, so nothing on the audio thread
+// allocates or locks.
+class AudioOutput {
+public:
+    explicit AudioOutput(APU& apu) : apu(apu) {}
+    ~AudioOutput() { close(); }
+    AudioOutput(const AudioOutput&) = delete;
+    AudioOutput& operator=(const AudioOutput&) = delete;
+
+    // Open the default device and start playback. False (with the reason on
+    // stderr) if SDL can't open it; the emulator then just runs silent.
+    bool open(int latencyMs);
+    void close();
+
+    // Measured on the audio thread, readable from any thread
+    struct Stats {
+        double latencyMs;     // ring + stream queue + device buffer, averaged
+        double jitterMs;      // mean deviation of callback spacing from the device period
+        double maxJitterMs;   // worst deviation seen
+        uint64_t underruns;   // callbacks that found the ring short
+        uint64_t callbacks;
+    };
+    Stats stats() const;
+
+    int deviceFrames() const { return frames; }
+
+private:
+    static void callback(void* userdata, SDL_AudioStream* stream, int additional, int total);
+    void feed(SDL_AudioStream* stream, int samples);
+
+    APU& apu;
+    SDL_AudioStream* stream = nullptr;
+    int frames = 0;               // device buffer, in samples
+    std::vector<float> scratch;   // the callback's only buffer
+    uint64_t lastCallback = 0;    // SDL_GetTicksNS() of the previous callback
+
+    std::atomic<double> latency{0.0};
+    std::atomic<double> jitter{0.0};
+    std::atomic<double> maxJitter{0.0};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> callbacks{0};
+};
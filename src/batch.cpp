@@ -0,0 +1,29 @@
+#include "batch.h"
+
+Console* BatchRunner::add(const std::string& path) {
+    auto nes = std::make_unique<Console>();
+    if (!nes->load(path)) return nullptr;
+    return keep(std::move(nes));
+}
+
+Console* BatchRunner::add(const std::vector<uint8_t>& image) {
+    auto nes = std::make_unique<Console>();
+    if (!nes->loadFromMemory(image)) return nullptr;
+    return keep(std::move(nes));
+}
+
+Console* BatchRunner::keep(std::unique_ptr<Console> nes) {
+    nes->apu.setOutputEnabled(false);
+    consoles.push_back(std::move(nes));
+    return consoles.back().get();
+}
+
+void BatchRunner::step(std::span<const uint8_t> inputs, int frames) {
+    pool.parallelFor(consoles.size(), [&](size_t i) {
+        Console& nes = *consoles[i];
+        nes.ctrl1.setButtonState(i < inputs.size() ? inputs[i] : 0);
+        for (int f = 0; f < frames; f++) {
+            nes.runFrame();
+        }
+    });
+}
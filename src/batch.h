@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+#include "console.h"
+#include "threadpool.h"
+
+// Steps many independent consoles in parallel, e.g. for reinforcement-learning
+// rollouts. Consoles are created once by add() and reused by every step, so
+// stepping allocates nothing and takes no locks. The pool hands out whole
+// consoles, so each one only ever runs on one thread at a time. Batch
+// consoles are silent: nobody drains their audio.
+class BatchRunner {
+public:
+    explicit BatchRunner(int threads = 0) : pool(threads) {} // 0 = all cores
+
+    // A new console running the ROM, or nullptr if it doesn't load. Configure
+    // it (CPU engine etc.) before the next step().
+    Console* add(const std::string& path);
+    Console* add(const std::vector<uint8_t>& image); // full iNES image
+
+    size_t size() const { return consoles.size(); }
+    Console& console(size_t i) { return *consoles[i]; }
+    int threads() const { return pool.threads(); }
+
+    // Hold player 1's buttons at inputs[i] (Controller::Button bits) on
+    // console i and run `frames` frames on every console. inputs needs an
+    // entry per console. Returns once all consoles are done.
+    void step(std::span<const uint8_t> inputs, int frames);
+
+private:
+    ThreadPool pool;
+    std::vector<std::unique_ptr<Console>> consoles;
+
+    Console* keep(std::unique_ptr<Console> nes);
+};
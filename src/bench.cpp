@@ -0,0 +1,616 @@
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "cartridge.h"
+#include "console.h"
+#include "rewind.h"
+#include "lockstep.h"
+#include "palette.h"
+#include "ntsc.h"
+#include "upscale.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdlib>
+
+// NTSC timing, used to express every kernel as "cost per emulated frame"
+static constexpr double PPU_DOTS_PER_FRAME = 341.0 * 262.0 - 0.5;
+static constexpr double CPU_CYCLES_PER_FRAME = PPU_DOTS_PER_FRAME / 3.0;
+
+struct Result {
+    std::string name;
+    uint64_t cycles = 0;        // kernel-specific unit (CPU cycles or PPU dots)
+    double seconds = 0.0;
+    double cyclesPerFrame = 0.0;
+    std::string note{};         // extra figures printed after the row
+
+    double cyclesPerSec() const { return cycles / seconds; }
+    double nsPerFrame() const { return seconds * 1e9 / (cycles / cyclesPerFrame); }
+};
+
+template <typename F>
+static double timeIt(F&& body) {
+    auto start = std::chrono::steady_clock::now();
+    body();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ===================== Synthetic cartridges =====================
+
+// Pseudo-random but deterministic CHR data so the PPU has real patterns to draw
+static std::vector<uint8_t> makeChr() {
+    std::vector<uint8_t> chr(8192);
+    uint32_t s = 7;
+    for (auto& b : chr) {
+        s = s * 1103515245u + 12345u;
+        b = (s >> 16) & 0xFF;
+    }
+    return chr;
+}
+
+// NROM-256 image with `program` at $8000 and all three vectors set
+static std::vector<uint8_t> makeRom(const std::vector<uint8_t>& program,
+                                    uint16_t nmiVector = 0x8000) {
+    std::vector<uint8_t> image = { 'N', 'E', 'S', 0x1A, 2, 1, 0x01, 0,
+                                   0, 0, 0, 0, 0, 0, 0, 0 };
+
+    std::vector<uint8_t> prg(32768, 0xEA);
+    std::copy(program.begin(), program.end(), prg.begin());
+    prg[0x7FFA] = nmiVector & 0xFF; prg[0x7FFB] = nmiVector >> 8;
+    prg[0x7FFC] = 0x00;             prg[0x7FFD] = 0x80;
+    prg[0x7FFE] = nmiVector & 0xFF; prg[0x7FFF] = nmiVector >> 8;
+
+    auto chr = makeChr();
+    image.insert(image.end(), prg.begin(), prg.end());
+    image.insert(image.end(), chr.begin(), chr.end());
+    return image;
+}
+
+// Register/ALU heavy straight-line code
+static const std::vector<uint8_t> progAlu = {
+    0xA9, 0x01,       // LDA #$01
+    0x69, 0x03,       // ADC #$03
+    0x29, 0x7F,       // AND #$7F
+    0x49, 0x55,       // EOR #$55
+    0x09, 0x10,       // ORA #$10
+    0xC9, 0x40,       // CMP #$40
+    0xE9, 0x02,       // SBC #$02
+    0x0A,             // ASL A
+    0x4A,             // LSR A
+    0x2A,             // ROL A
+    0x6A,             // ROR A
+    0xAA,             // TAX
+    0xE8,             // INX
+    0x8A,             // TXA
+    0xA8,             // TAY
+    0x88,             // DEY
+    0x98,             // TYA
+    0x18,             // CLC
+    0x38,             // SEC
+    0x4C, 0x00, 0x80, // JMP $8000
+};
+
+// Indexed and indirect loads/stores into RAM
+static const std::vector<uint8_t> progMemory = {
+    0xA2, 0x00,       // $8000 LDX #$00
+    0xB5, 0x10,       // $8002 LDA $10,X
+    0x95, 0x20,       //       STA $20,X
+    0xBD, 0x00, 0x03, //       LDA $0300,X
+    0x9D, 0x00, 0x04, //       STA $0400,X
+    0xF6, 0x30,       //       INC $30,X
+    0xB1, 0x40,       //       LDA ($40),Y
+    0x91, 0x42,       //       STA ($42),Y
+    0xA1, 0x44,       //       LDA ($44,X)
+    0xE8,             //       INX
+    0xD0, 0xEB,       //       BNE $8002
+    0x4C, 0x00, 0x80, //       JMP $8000
+};
+
+// Calls, stack traffic and short branchy loops
+static const std::vector<uint8_t> progBranch = {
+    0xA0, 0x10,       // $8000 LDY #$10
+    0x20, 0x10, 0x80, // $8002 JSR $8010
+    0x88,             //       DEY
+    0xD0, 0xFA,       //       BNE $8002
+    0x4C, 0x00, 0x80, //       JMP $8000
+    0xEA, 0xEA, 0xEA, 0xEA, 0xEA,
+    0x48,             // $8010 PHA
+    0x08,             //       PHP
+    0xA2, 0x08,       //       LDX #$08
+    0xCA,             // $8014 DEX
+    0x10, 0xFD,       //       BPL $8014
+    0x28,             //       PLP
+    0x68,             //       PLA
+    0x60,             //       RTS
+};
+
+// Read-modify-write, including the unofficial combined opcodes
+static const std::vector<uint8_t> progRmw = {
+    0xE6, 0x10,       // INC $10
+    0x06, 0x11,       // ASL $11
+    0x26, 0x12,       // ROL $12
+    0x46, 0x13,       // LSR $13
+    0x66, 0x14,       // ROR $14
+    0xC6, 0x15,       // DEC $15
+    0xEE, 0x00, 0x03, // INC $0300
+    0x07, 0x16,       // SLO $16
+    0x27, 0x17,       // RLA $17
+    0x47, 0x18,       // SRE $18
+    0x67, 0x19,       // RRA $19
+    0xC7, 0x1A,       // DCP $1A
+    0xE7, 0x1B,       // ISB $1B
+    0xA7, 0x1C,       // LAX $1C
+    0x87, 0x1D,       // SAX $1D
+    0x4C, 0x00, 0x80, // JMP $8000
+};
+
+// Reads controller 1 and takes a longer path while A is held, so lanes with
+// different input diverge at the branch and rejoin at $8016
+static const std::vector<uint8_t> progDiverge = {
+    0xA9, 0x01,       // $8000 LDA #$01
+    0x8D, 0x16, 0x40, //       STA $4016
+    0xA9, 0x00,       //       LDA #$00
+    0x8D, 0x16, 0x40, //       STA $4016
+    0xAD, 0x16, 0x40, //       LDA $4016
+    0x29, 0x01,       //       AND #$01
+    0xF0, 0x05,       //       BEQ $8016
+    0xE8,             //       INX
+    0xE8,             //       INX
+    0xE8,             //       INX
+    0xE8,             //       INX
+    0xE8,             //       INX
+    0xC8,             // $8016 INY
+    0x65, 0x10,       //       ADC $10
+    0x85, 0x10,       //       STA $10
+    0x95, 0x20,       //       STA $20,X
+    0x4C, 0x00, 0x80, //       JMP $8000
+};
+
+// Whole-system program: fill palette/nametables/OAM, enable NMI + rendering,
+// spin in a small loop; the NMI handler does OAM DMA and moves the scroll.
+static const std::vector<uint8_t> progSystem = {
+    0x78,             // $8000 SEI
+    0xD8,             //       CLD
+    0xA2, 0xFF,       //       LDX #$FF
+    0x9A,             //       TXS
+    0xA9, 0x3F,       //       LDA #$3F
+    0x8D, 0x06, 0x20, //       STA $2006
+    0xA9, 0x00,       //       LDA #$00
+    0x8D, 0x06, 0x20, //       STA $2006
+    0xA2, 0x00,       //       LDX #$00
+    0x8A,             // $8011 TXA
+    0x8D, 0x07, 0x20, //       STA $2007
+    0xE8,             //       INX
+    0xE0, 0x20,       //       CPX #$20
+    0xD0, 0xF7,       //       BNE $8011
+    0xA9, 0x20,       //       LDA #$20
+    0x8D, 0x06, 0x20, //       STA $2006
+    0xA9, 0x00,       //       LDA #$00
+    0x8D, 0x06, 0x20, //       STA $2006
+    0xA0, 0x08,       //       LDY #$08
+    0xA2, 0x00,       //       LDX #$00
+    0x8A,             // $8028 TXA
+    0x8D, 0x07, 0x20, //       STA $2007
+    0xE8,             //       INX
+    0xD0, 0xF9,       //       BNE $8028
+    0x88,             //       DEY
+    0xD0, 0xF6,       //       BNE $8028
+    0x8A,             // $8032 TXA
+    0x9D, 0x00, 0x02, //       STA $0200,X
+    0xE8,             //       INX
+    0xD0, 0xF9,       //       BNE $8032
+    0xA9, 0x90,       //       LDA #$90
+    0x8D, 0x00, 0x20, //       STA $2000
+    0xA9, 0x1E,       //       LDA #$1E
+    0x8D, 0x01, 0x20, //       STA $2001
+    0xA9, 0x01,       // $8043 LDA #$01
+    0x69, 0x03,       //       ADC #$03
+    0x85, 0x10,       //       STA $10
+    0xE6, 0x11,       //       INC $11
+    0x4C, 0x43, 0x80, //       JMP $8043
+    0xEA, 0xEA, 0xEA, 0xEA, 0xEA,
+    0x48,             // $8050 PHA
+    0xA9, 0x02,       //       LDA #$02
+    0x8D, 0x14, 0x40, //       STA $4014
+    0xA5, 0x11,       //       LDA $11
+    0x8D, 0x05, 0x20, //       STA $2005
+    0x8D, 0x05, 0x20, //       STA $2005
+    0x68,             //       PLA
+    0x40,             //       RTI
+};
+
+// ===================== Kernels =====================
+
+enum class Engine { Interpreter, Cached, Jit };
+
+static Result benchCpu(const char* name, const std::vector<uint8_t>& program, Engine engine,
+                       long frames) {
+    Cartridge cartridge;
+    cartridge.loadFromMemory(makeRom(program));
+
+    // CPU + RAM + PRG only: no PPU/APU so only instruction execution is measured
+    CPU cpu;
+    Bus bus;
+    bus.connectCartridge(&cartridge);
+    cpu.connectBus(&bus);
+    cpu.reset();
+
+    uint64_t target = (uint64_t)(frames * CPU_CYCLES_PER_FRAME);
+    uint64_t cycles = 0;
+    double seconds = timeIt([&] {
+        if (engine != Engine::Interpreter) {
+            // Whole blocks at a time; dots are 3 per cycle, as on the bus
+            cpu.setBlockCache(true);
+            cpu.setJit(engine == Engine::Jit);
+            uint64_t dot = 0;
+            bool stop = false;
+            while (dot < target * 3) {
+                cpu.runBlock(dot, target * 3, stop);
+                dot += 3 * (uint64_t)(cpu.pendingCycles() + 1);
+                cpu.skipCycles(cpu.pendingCycles());
+            }
+            cycles = dot / 3;
+        } else {
+            while (cycles < target) {
+                cycles += cpu.step();
+            }
+        }
+    });
+    return { name, cycles, seconds, CPU_CYCLES_PER_FRAME };
+}
+
+static Result benchPpu(const char* name, bool rendering, bool batched, long frames) {
+    Cartridge cartridge;
+    cartridge.loadFromMemory(makeRom(progAlu));
+
+    PPU ppu;
+    ppu.connectCartridge(&cartridge);
+
+    // Palette, both nametables and OAM get varied contents
+    ppu.cpuWrite(0x2006, 0x3F); ppu.cpuWrite(0x2006, 0x00);
+    for (int i = 0; i < 32; i++) ppu.cpuWrite(0x2007, (uint8_t)(i * 5 + 1));
+    ppu.cpuWrite(0x2006, 0x20); ppu.cpuWrite(0x2006, 0x00);
+    for (int i = 0; i < 2048; i++) ppu.cpuWrite(0x2007, (uint8_t)(i * 7 + (i >> 5)));
+    for (int i = 0; i < 256; i++) ppu.getOAM()[i] = (uint8_t)(i * 13);
+
+    ppu.cpuWrite(0x2000, 0x10);
+    ppu.cpuWrite(0x2001, rendering ? 0x1E : 0x00);
+    ppu.cpuWrite(0x2005, 0x03); ppu.cpuWrite(0x2005, 0x00);
+
+    uint64_t dots = (uint64_t)(frames * PPU_DOTS_PER_FRAME);
+    double seconds = timeIt([&] {
+        if (batched) {
+            // Same dots handed over a frame at a time (scanline fast path)
+            for (uint64_t done = 0; done < dots; done += 89342) {
+                ppu.run((int)std::min<uint64_t>(89342, dots - done));
+            }
+        } else {
+            for (uint64_t i = 0; i < dots; i++) {
+                ppu.clock();
+            }
+        }
+    });
+    return { name, dots, seconds, PPU_DOTS_PER_FRAME };
+}
+
+static Result benchApu(const char* name, long frames) {
+    APU apu;
+
+    // All four implemented channels audible for the whole run
+    const std::pair<uint16_t, uint8_t> regs[] = {
+        { 0x4015, 0x0F },
+        { 0x4000, 0xBF }, { 0x4001, 0x00 }, { 0x4002, 0xFD }, { 0x4003, 0x00 },
+        { 0x4004, 0x7A }, { 0x4005, 0x9A }, { 0x4006, 0x40 }, { 0x4007, 0x01 },
+        { 0x4008, 0xFF }, { 0x400A, 0x80 }, { 0x400B, 0x00 },
+        { 0x400C, 0x3F }, { 0x400E, 0x05 }, { 0x400F, 0x00 },
+        { 0x4017, 0x40 },
+    };
+    for (auto& [addr, val] : regs) apu.cpuWrite(addr, val);
+
+    std::vector<float> drain(APU::SAMPLE_RATE / 60 + 1);
+    uint64_t perFrame = (uint64_t)CPU_CYCLES_PER_FRAME;
+    uint64_t cycles = 0;
+    double seconds = timeIt([&] {
+        for (long f = 0; f < frames; f++) {
+            apu.run(perFrame);
+            // Console::runFrame's flush, then stand in for the audio callback
+            apu.flushSamples();
+            apu.fillBuffer(drain.data(), (int)drain.size());
+            cycles += perFrame;
+        }
+    });
+    return { name, cycles, seconds, CPU_CYCLES_PER_FRAME };
+}
+
+static Result benchSystem(const char* name, Engine engine, long frames) {
+    Console nes;
+    nes.cpu.setBlockCache(engine != Engine::Interpreter);
+    nes.cpu.setJit(engine == Engine::Jit);
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+
+    uint64_t startDots = nes.bus.totalCycles();
+    double seconds = timeIt([&] {
+        for (long f = 0; f < frames; f++) {
+            nes.runFrame();
+        }
+    });
+    return { name, nes.bus.totalCycles() - startDots, seconds, PPU_DOTS_PER_FRAME };
+}
+
+// Palette indices to ARGB for a rendered frame; the unit is pixels
+static Result benchPalette(const char* name, long frames) {
+    Console nes;
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+    for (int f = 0; f < 10; f++) nes.runFrame();
+
+    std::vector<uint32_t> argb(256 * 240);
+    uint64_t count = (uint64_t)frames * 10;
+    double seconds = timeIt([&] {
+        for (uint64_t i = 0; i < count; i++) expandFrame(nes.frameBuffer(), nes.lineEmphasis(), argb.data());
+    });
+    return { name, count * 256 * 240, seconds, 256 * 240 };
+}
+
+// Composite filter on two worker threads, the frontend's configuration;
+// counted per NES pixel like palette_expand
+static Result benchNtsc(const char* name, long frames) {
+    Console nes;
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+    for (int f = 0; f < 10; f++) nes.runFrame();
+
+    NtscFilter ntsc(2);
+    std::vector<uint32_t> argb(NtscFilter::OUT_WIDTH * NtscFilter::HEIGHT);
+    uint64_t count = (uint64_t)frames;
+    double seconds = timeIt([&] {
+        for (uint64_t i = 0; i < count; i++) ntsc.filter(nes.frameBuffer(), nes.lineEmphasis(), argb.data(), i);
+    });
+    return { name, count * 256 * 240, seconds, 256 * 240 };
+}
+
+// 4x xBRZ on four threads, counted per source pixel. The test frame is
+// noise-like, nearly every pixel an edge: the worst case for the filter.
+static Result benchUpscale(const char* name, long frames) {
+    Console nes;
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+    for (int f = 0; f < 10; f++) nes.runFrame();
+
+    std::vector<uint32_t> argb(256 * 240);
+    expandFrame(nes.frameBuffer(), nes.lineEmphasis(), argb.data());
+    Upscaler upscaler(Upscaler::Filter::Xbrz4, 4);
+    std::vector<uint32_t> out(argb.size() * 16);
+    uint64_t count = (uint64_t)frames;
+    double seconds = timeIt([&] {
+        for (uint64_t i = 0; i < count; i++) upscaler.upscale(argb.data(), out.data());
+    });
+    return { name, count * 256 * 240, seconds, 256 * 240 };
+}
+
+// One whole-system snapshot (or restore) counts as one "frame", so ns/frame
+// reads as ns per snapshot
+static Result benchState(const char* name, bool load, long frames) {
+    Console nes;
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+
+    // Somewhere past the setup code, with rendering on
+    for (int f = 0; f < 10; f++) nes.runFrame();
+
+    std::vector<uint8_t> state(nes.bus.stateSize());
+    nes.bus.saveState(state);
+    uint64_t count = (uint64_t)frames * 100;
+    double seconds = timeIt([&] {
+        for (uint64_t i = 0; i < count; i++) {
+            if (load) nes.bus.loadState(state);
+            else nes.bus.saveState(state);
+        }
+    });
+    return { name, count, seconds, 1.0 };
+}
+
+// Rewind capture of a recorded run: XOR against the keyframe plus coding,
+// per frame (snapshot cost is state_save's)
+static Result benchRewind(const char* name, long frames) {
+    Console nes;
+    nes.loadFromMemory(makeRom(progSystem, 0x8050));
+
+    std::vector<std::vector<uint8_t>> states(std::min<long>(frames, 600));
+    for (auto& state : states) {
+        nes.runFrame();
+        state.resize(nes.bus.stateSize());
+        nes.bus.saveState(state);
+    }
+
+    Rewind rewind;
+    double seconds = timeIt([&] {
+        for (long f = 0; f < frames; f++) {
+            rewind.push(states[f % states.size()]);
+        }
+    });
+    return { name, (uint64_t)frames, seconds, 1.0 };
+}
+
+// 64 copies of a CPU program, in lock-step or each on its own scalar CPU
+// (the batch baseline). Cycles are summed over the lanes, so ns/frame reads
+// as ns per lane-frame. Half the lanes hold A, for progDiverge.
+static Result benchLockstep(const char* name, const std::vector<uint8_t>& program, bool scalar,
+                            long frames) {
+    const int lanes = 64;
+    LockstepCpu cpu(lanes);
+    cpu.load(makeRom(program));
+    cpu.setScalarOnly(scalar);
+    for (int l = 0; l < lanes; l++) cpu.setButtons(l, (l & 1) ? Controller::A : 0);
+
+    uint64_t perLane = (uint64_t)(frames * CPU_CYCLES_PER_FRAME);
+    double seconds = timeIt([&] { cpu.run(perLane); });
+
+    uint64_t cycles = 0;
+    for (int l = 0; l < lanes; l++) cycles += cpu.laneCycles(l);
+    std::ostringstream note;
+    note << std::fixed << std::setprecision(1) << "  " << cpu.instructions() / seconds / 1e6
+         << " Minstr/s";
+    if (!scalar) {
+        note << ", lanes " << std::setprecision(0) << cpu.laneUtilization() * 100.0
+             << "% busy, " << 100.0 * cpu.scalarInstructions() / cpu.instructions() << "% scalar";
+    }
+    return { name, cycles, seconds, CPU_CYCLES_PER_FRAME, note.str() };
+}
+
+// ===================== Baseline I/O =====================
+
+static void writeJson(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out(path);
+    out << "{\n  \"kernels\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        out << std::fixed << std::setprecision(3)
+            << "    {\"name\": \"" << r.name << "\", \"cycles\": " << r.cycles
+            << ", \"seconds\": " << std::setprecision(6) << r.seconds
+            << ", \"cycles_per_sec\": " << std::setprecision(1) << r.cyclesPerSec()
+            << ", \"ns_per_frame\": " << r.nsPerFrame() << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "  ]\n}\n";
+}
+
+// Reads back the one-kernel-per-line layout produced by writeJson()
+static std::map<std::string, double> readBaseline(const std::string& path) {
+    std::map<std::string, double> nsPerFrame;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto name = line.find("\"name\": \"");
+        auto ns = line.find("\"ns_per_frame\": ");
+        if (name == std::string::npos || ns == std::string::npos) continue;
+        name += 9;
+        std::string key = line.substr(name, line.find('"', name) - name);
+        nsPerFrame[key] = std::strtod(line.c_str() + ns + 16, nullptr);
+    }
+    return nsPerFrame;
+}
+
+int main(int argc, char* argv[]) {
+    long frames = 300;
+    int repeats = 3;
+    std::string filter, jsonPath, baselinePath;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeats = std::atoi(argv[++i]);
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else {
+            std::cerr << "Usage: ./nes_bench [--frames N] [--repeat N] [--filter substr]\n"
+                         "                  [--json out.json] [--baseline old.json]\n";
+            return 1;
+        }
+    }
+    if (frames <= 0 || repeats <= 0) {
+        std::cerr << "--frames and --repeat must be positive\n";
+        return 1;
+    }
+
+    struct Kernel {
+        const char* name;
+        Result (*run)(const char*, long);
+    };
+    const Kernel kernels[] = {
+        { "cpu_alu",      [](const char* n, long f) { return benchCpu(n, progAlu, Engine::Interpreter, f); } },
+        { "cpu_memory",   [](const char* n, long f) { return benchCpu(n, progMemory, Engine::Interpreter, f); } },
+        { "cpu_branch",   [](const char* n, long f) { return benchCpu(n, progBranch, Engine::Interpreter, f); } },
+        { "cpu_rmw",      [](const char* n, long f) { return benchCpu(n, progRmw, Engine::Interpreter, f); } },
+        { "cached_alu",   [](const char* n, long f) { return benchCpu(n, progAlu, Engine::Cached, f); } },
+        { "cached_memory", [](const char* n, long f) { return benchCpu(n, progMemory, Engine::Cached, f); } },
+        { "cached_branch", [](const char* n, long f) { return benchCpu(n, progBranch, Engine::Cached, f); } },
+        { "cached_rmw",   [](const char* n, long f) { return benchCpu(n, progRmw, Engine::Cached, f); } },
+        { "jit_alu",      [](const char* n, long f) { return benchCpu(n, progAlu, Engine::Jit, f); } },
+        { "jit_memory",   [](const char* n, long f) { return benchCpu(n, progMemory, Engine::Jit, f); } },
+        { "jit_branch",   [](const char* n, long f) { return benchCpu(n, progBranch, Engine::Jit, f); } },
+        { "jit_rmw",      [](const char* n, long f) { return benchCpu(n, progRmw, Engine::Jit, f); } },
+        { "ppu_render",   [](const char* n, long f) { return benchPpu(n, true, false, f); } },
+        { "ppu_idle",     [](const char* n, long f) { return benchPpu(n, false, false, f); } },
+        { "ppu_run_render", [](const char* n, long f) { return benchPpu(n, true, true, f); } },
+        { "ppu_run_idle", [](const char* n, long f) { return benchPpu(n, false, true, f); } },
+        { "apu_all",      [](const char* n, long f) { return benchApu(n, f); } },
+        { "bus_system",   [](const char* n, long f) { return benchSystem(n, Engine::Interpreter, f); } },
+        { "bus_cached",   [](const char* n, long f) { return benchSystem(n, Engine::Cached, f); } },
+        { "bus_jit",      [](const char* n, long f) { return benchSystem(n, Engine::Jit, f); } },
+        { "palette_expand", [](const char* n, long f) { return benchPalette(n, f); } },
+        { "ntsc_filter",  [](const char* n, long f) { return benchNtsc(n, f); } },
+        { "upscale_xbrz4", [](const char* n, long f) { return benchUpscale(n, f); } },
+        { "state_save",   [](const char* n, long f) { return benchState(n, false, f); } },
+        { "state_load",   [](const char* n, long f) { return benchState(n, true, f); } },
+        { "rewind_push",  [](const char* n, long f) { return benchRewind(n, f); } },
+        { "batch_alu",    [](const char* n, long f) { return benchLockstep(n, progAlu, true, f); } },
+        { "lockstep_alu", [](const char* n, long f) { return benchLockstep(n, progAlu, false, f); } },
+        { "batch_memory", [](const char* n, long f) { return benchLockstep(n, progMemory, true, f); } },
+        { "lockstep_memory", [](const char* n, long f) { return benchLockstep(n, progMemory, false, f); } },
+        { "batch_diverge", [](const char* n, long f) { return benchLockstep(n, progDiverge, true, f); } },
+        { "lockstep_diverge", [](const char* n, long f) { return benchLockstep(n, progDiverge, false, f); } },
+    };
+
+    std::map<std::string, double> baseline;
+    if (!baselinePath.empty()) {
+        baseline = readBaseline(baselinePath);
+        if (baseline.empty()) {
+            std::cerr << "Warning: no kernels found in " << baselinePath << "\n";
+        }
+    }
+
+    // The synthetic cartridges log on load; keep stdout to the table
+    std::streambuf* coutBuf = std::cout.rdbuf();
+    std::ostringstream sink;
+
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(16) << "kernel"
+              << std::right << std::setw(14) << "Mcycles/s"
+              << std::setw(14) << "ns/frame"
+              << std::setw(12) << "vs base" << "\n";
+
+    for (const Kernel& k : kernels) {
+        if (!filter.empty() && std::string(k.name).find(filter) == std::string::npos) continue;
+
+        // Best of N to cut scheduler noise
+        Result best;
+        for (int r = 0; r < repeats; r++) {
+            std::cout.rdbuf(sink.rdbuf());
+            Result res = k.run(k.name, frames);
+            std::cout.rdbuf(coutBuf);
+            if (r == 0 || res.nsPerFrame() < best.nsPerFrame()) best = res;
+        }
+        results.push_back(best);
+
+        std::cout << std::left << std::setw(16) << best.name << std::right << std::fixed
+                  << std::setw(14) << std::setprecision(2) << best.cyclesPerSec() / 1e6
+                  << std::setw(14) << std::setprecision(0) << best.nsPerFrame();
+        auto it = baseline.find(best.name);
+        if (it != baseline.end() && it->second > 0.0) {
+            // Positive = faster than the baseline
+            double speedup = (it->second / best.nsPerFrame() - 1.0) * 100.0;
+            std::cout << std::setw(11) << std::showpos << std::setprecision(1)
+                      << speedup << "%" << std::noshowpos;
+        } else if (!best.note.empty()) {
+            std::cout << std::setw(12) << "";
+        }
+        std::cout << best.note << "\n";
+    }
+
+    if (!jsonPath.empty()) {
+        writeJson(jsonPath, results);
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include "blip.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+constexpr int WIDTH = BlipBuffer::WIDTH;
+constexpr int PHASES = BlipBuffer::PHASES;
+
+// Impulse response of a band-limited step starting `phase / PHASES` of a
+// sample after tap 0, centred WIDTH/2 taps in. Each phase sums to LEVEL_ONE.
+struct Kernel {
+    int16_t taps[PHASES][WIDTH];
+
+    Kernel() {
+        const double pi = 3.14159265358979323846;
+        const double cutoff = 0.45; // of the sample rate, a little under Nyquist
+        for (int p = 0; p < PHASES; p++) {
+            double h[WIDTH];
+            double total = 0.0;
+            for (int k = 0; k < WIDTH; k++) {
+                double t = k - WIDTH / 2 - (double)p / PHASES;
+                double x = 2.0 * cutoff * t;
+                double sinc = x == 0.0 ? 1.0 : std::sin(pi * x) / (pi * x);
+                // Blackman window over [-WIDTH/2, WIDTH/2]
+                double w = (t + WIDTH / 2) / WIDTH;
+                double window = 0.42 - 0.5 * std::cos(2 * pi * w) + 0.08 * std::cos(4 * pi * w);
+                h[k] = sinc * window;
+                total += h[k];
+            }
+            int sum = 0, peak = 0;
+            for (int k = 0; k < WIDTH; k++) {
+                taps[p][k] = (int16_t)std::lround(h[k] / total * BlipBuffer::LEVEL_ONE);
+                sum += taps[p][k];
+                if (std::abs(taps[p][k]) > std::abs(taps[p][peak])) peak = k;
+            }
+            // Rounding error goes to the largest tap
+            taps[p][peak] = (int16_t)(taps[p][peak] + BlipBuffer::LEVEL_ONE - sum);
+        }
+    }
+};
+
+const Kernel kernel;
+
+} // namespace
+
+BlipBuffer::BlipBuffer(double clockRate, double sampleRate) {
+    setRates(clockRate, sampleRate);
+}
+
+void BlipBuffer::setRates(double clockRate, double sampleRate) {
+    factor = (uint64_t)std::llround(sampleRate / clockRate * (double)(1ull << FRAC_BITS));
+}
+
+void BlipBuffer::addDelta(uint32_t time, int delta) {
+    uint64_t pos = offset + time * factor;
+    int index = (int)(pos >> FRAC_BITS);
+    int phase = (int)(pos >> (FRAC_BITS - PHASE_BITS)) & (PHASES - 1);
+    const int16_t* taps = kernel.taps[phase];
+    int64_t* out = deltas.data() + index;
+    // |delta| and |taps| are both at most LEVEL_ONE, so the product fits 32
+    // bits: a 32-bit multiply widened for the add vectorizes (SSE4.1/AVX2),
+    // where a 64-bit multiply would not
+    for (int k = 0; k < WIDTH; k++) {
+        out[k] += (int64_t)(delta * (int32_t)taps[k]);
+    }
+}
+
+int BlipBuffer::endFrame(uint32_t clocks, float* out) {
+    uint64_t end = offset + clocks * factor;
+    int count = (int)(end >> FRAC_BITS);
+    offset = end & ((1ull << FRAC_BITS) - 1);
+
+    const float scale = 1.0f / ((float)LEVEL_ONE * LEVEL_ONE);
+    for (int i = 0; i < count; i++) {
+        sum += deltas[i];
+        out[i] = (float)sum * scale;
+    }
+
+    // Kernel tails of the last steps carry into the next frame
+    std::copy(deltas.begin() + count, deltas.begin() + count + WIDTH, deltas.begin());
+    std::fill(deltas.begin() + WIDTH, deltas.begin() + count + WIDTH, 0);
+    return count;
+}
+
+void BlipBuffer::clear() {
+    offset = 0;
+    current = 0;
+    sum = 0;
+    deltas.fill(0);
+}
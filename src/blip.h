@@ -0,0 +1,57 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+// Band-limited step synthesis, after blargg's blip_buf. The APU reports each
+// change of its mixed output as a step at a CPU-clock timestamp; the step is
+// written into a delta buffer as a windowed-sinc impulse, so nothing above
+// the output Nyquist frequency survives. At the end of a frame the deltas are
+// integrated (a running sum) into output samples in one pass. Cost scales
+// with the number of level changes, not with the CPU clock rate.
+//
+// Levels and deltas are fixed point (LEVEL_ONE = 1.0) and the kernel phases
+// each sum to exactly one, so the running sum never drifts.
+class BlipBuffer {
+public:
+    BlipBuffer(double clockRate, double sampleRate);
+
+    // Change the resampling ratio. Any fraction works, so a rate controller
+    // can steer it continuously; call it between frames (right after
+    // endFrame()) so every step of a frame is placed with one ratio.
+    void setRates(double clockRate, double sampleRate);
+
+    static constexpr int LEVEL_ONE = 1 << 15;
+
+    // Longest frame endFrame() accepts, in clocks, and the most samples it can
+    // then produce
+    static constexpr uint32_t MAX_FRAME_CLOCKS = 1 << 16;
+    static constexpr int MAX_SAMPLES = 2048;
+
+    // A step from the current level to `level`, `time` clocks into the frame
+    void setLevel(uint32_t time, int level) {
+        if (level != current) {
+            addDelta(time, level - current);
+            current = level;
+        }
+    }
+    void addDelta(uint32_t time, int delta);
+
+    // Close a frame `clocks` long and integrate the samples it completed into
+    // `out` (room for MAX_SAMPLES); returns how many
+    int endFrame(uint32_t clocks, float* out);
+
+    void clear();
+
+    static constexpr int WIDTH = 16;     // kernel taps
+    static constexpr int PHASE_BITS = 6; // sub-sample step positions
+    static constexpr int PHASES = 1 << PHASE_BITS;
+
+private:
+    static constexpr int FRAC_BITS = 32;
+
+    uint64_t factor;     // samples per clock, FRAC_BITS fixed point
+    uint64_t offset = 0; // sample position of clock 0 in this frame
+    int current = 0;     // level after the last step
+    int64_t sum = 0;     // integrator
+    std::array<int64_t, MAX_SAMPLES + WIDTH> deltas{};
+};
@@ -4,17 +4,53 @@
 #include "apu.h"
 #include "cartridge.h"
 #include "controller.h"
+#include "state.h"
+#include <iostream>
 
 Bus::Bus() {
     ram.fill(0);
+
+    // $0000-$1FFF: 2KB RAM mirrored four times
+    for (int page = 0; page < 0x20; page++) {
+        readPages[page] = &ram[(page & 0x07) << 8];
+        writePages[page] = &ram[(page & 0x07) << 8];
+    }
+}
+
+void Bus::connectCartridge(Cartridge* c) {
+    cartridge = c;
+    if (cartridge) cartridge->connectBus(this);
+    remapCartridge();
 }
 
-uint8_t Bus::cpuRead(uint16_t addr) {
+void Bus::remapCartridge() {
+    for (int page = 0x40; page < 0x100; page++) {
+        readPages[page] = cartridge ? cartridge->cpuReadPage((uint8_t)page) : nullptr;
+        writePages[page] = cartridge ? cartridge->cpuWritePage((uint8_t)page) : nullptr;
+        versions[page]++;
+    }
+    epoch++;
+}
+
+void Bus::watchPage(uint8_t page) {
+    if (page < 0x20) {
+        for (int mirror = page & 0x07; mirror < 0x20; mirror += 0x08) {
+            writePages[mirror] = nullptr;
+        }
+    } else {
+        writePages[page] = nullptr;
+    }
+}
+
+uint8_t Bus::ioRead(uint16_t addr) {
+    ioAccess = true;
     if (addr < 0x2000) {
         return ram[addr & 0x07FF];
     } else if (addr < 0x4000) {
+        syncPPU(cpuTime);
         return ppu ? ppu->cpuRead(addr) : 0;
     } else if (addr == 0x4015) {
+        syncAPU(cpuTime);
         return apu ? apu->cpuRead(addr) : 0;
     } else if (addr == 0x4016) {
         return ctrl1 ? ctrl1->read() : 0;
@@ -28,11 +64,16 @@ uint8_t Bus::cpuRead(uint16_t addr) {
     }
 }
 
-void Bus::cpuWrite(uint16_t addr, uint8_t val) {
+void Bus::ioWrite(uint16_t addr, uint8_t val) {
+    ioAccess = true;
+    versions[versionSlot(addr >> 8)]++;
+    epoch++;
     if (addr < 0x2000) {
         ram[addr & 0x07FF] = val;
     } else if (addr < 0x4000) {
+        syncPPU(cpuTime);
         if (ppu) ppu->cpuWrite(addr, val);
+        ppuWritten = true;
     } else if (addr == 0x4014) {
         // OAM DMA
         dmaPage = val;
@@ -44,17 +85,109 @@ void Bus::cpuWrite(uint16_t addr, uint8_t val) {
         if (ctrl2) ctrl2->write(val);
     } else if (addr < 0x4020) {
         // APU registers ($4000-$4013, $4015, $4017)
+        syncAPU(cpuTime);
         if (apu) apu->cpuWrite(addr, val);
     } else {
         if (cartridge) cartridge->cpuWrite(addr, val);
     }
 }
 
+void Bus::syncPPU(uint64_t dot) {
+    if (!ppu || ppuClock > dot) return;
+    ppu->run((int)(dot + 1 - ppuClock));
+    ppuClock = dot + 1;
+}
+
+void Bus::syncAPU(uint64_t dot) {
+    if (!apu) return;
+    // The APU ticks on CPU cycles, i.e. every third dot
+    if (apuClock < dot) {
+        uint64_t cycles = (dot - apuClock + 2) / 3;
+        apu->run(cycles);
+        apuClock += 3 * cycles;
+    }
+}
+
+void Bus::pollNMI() {
+    if (ppu && cpu && ppu->nmiOccurred()) {
+        ppu->clearNMI();
+        cpu->nmi();
+    }
+}
+
 void Bus::clock() {
+    // DMA has per-cycle side effects, and a partial system has no schedule
+    if (dmaActive || !cpu || !ppu) {
+        tick();
+        return;
+    }
+
+    // Dot on which the PPU will enter vblank (raising NMI / frameReady)
+    uint64_t vblank = ppuClock + ppu->dotsUntilVblank() - 1;
+    ppuWritten = false;
+
+    for (;;) {
+        // The CPU runs on every third dot; its next instruction starts once
+        // the cycles left over from the previous one have been burned
+        uint64_t nextCpuDot = (systemClock + 2) / 3 * 3;
+        uint64_t exec = nextCpuDot + 3 * (uint64_t)cpu->pendingCycles();
+
+        if (vblank < exec) {
+            // vblank lands while the CPU is still busy: stop exactly there
+            if (vblank >= nextCpuDot) {
+                cpu->skipCycles((int)((vblank - nextCpuDot) / 3 + 1));
+            }
+            syncPPU(vblank);
+            systemClock = vblank + 1;
+            syncAPU(systemClock);
+            pollNMI();
+            return;
+        }
+
+        // Run the whole instruction now; any PPU/APU register it touches
+        // first brings that chip up to this dot
+        cpu->skipCycles(cpu->pendingCycles());
+        cpuTime = exec;
+        if (cpu->blockCacheEnabled() && exec < vblank) {
+            // Nothing can raise NMI or start DMA without a slow-path access,
+            // so a whole block can run before the checks below
+            ioAccess = false;
+            cpu->runBlock(cpuTime, vblank, ioAccess);
+            exec = cpuTime;
+        } else {
+            cpu->clock();
+        }
+        systemClock = exec + 1;
+
+        if (exec == vblank) {
+            // Same dot as vblank: the PPU goes first, then the NMI check
+            syncPPU(exec);
+            syncAPU(systemClock);
+            pollNMI();
+            return;
+        }
+
+        // A PPUCTRL write during vblank can raise NMI immediately
+        pollNMI();
+
+        if (dmaActive) return;
+
+        if (ppuWritten) {
+            // PPUMASK decides the odd-frame skip, so re-predict vblank
+            ppuWritten = false;
+            vblank = ppuClock + ppu->dotsUntilVblank() - 1;
+        }
+    }
+}
+
+void Bus::tick() {
     // PPU runs at 3x CPU speed
-    if (ppu) ppu->clock();
+    syncPPU(systemClock);
 
     if (systemClock % 3 == 0) {
+        syncAPU(systemClock);
+        cpuTime = systemClock;
+
         // Handle DMA
         if (dmaActive) {
             if (dmaSync) {
@@ -79,14 +212,82 @@ void Bus::clock() {
         }
 
         // Clock APU at CPU rate
-        if (apu) apu->clock();
+        syncAPU(systemClock + 1);
     }
 
     // Check for NMI
-    if (ppu && cpu && ppu->nmiOccurred()) {
-        ppu->clearNMI();
-        cpu->nmi();
-    }
+    pollNMI();
 
     systemClock++;
 }
+
+void Bus::writeState(StateWriter& w) const {
+    w.pod(StateHeader{STATE_MAGIC, STATE_VERSION, 0}); // size patched by saveState()
+    w.pod(ram);
+    w.pod(systemClock); w.pod(ppuClock); w.pod(apuClock); w.pod(cpuTime);
+    w.pod(ppuWritten);
+    w.pod(dmaActive); w.pod(dmaSync); w.pod(dmaPage); w.pod(dmaAddr); w.pod(dmaData);
+    if (cpu) cpu->saveState(w);
+    if (ppu) ppu->saveState(w);
+    if (apu) apu->saveState(w);
+    if (cartridge) cartridge->saveState(w);
+    if (ctrl1) ctrl1->saveState(w);
+    if (ctrl2) ctrl2->saveState(w);
+}
+
+size_t Bus::stateSize() const {
+    StateWriter measure;
+    writeState(measure);
+    return measure.size();
+}
+
+size_t Bus::saveState(std::span<uint8_t> out) const {
+    StateWriter w(out);
+    writeState(w);
+    if (!w.ok()) return 0;
+    uint32_t size = (uint32_t)w.size();
+    std::memcpy(out.data() + offsetof(StateHeader, size), &size, sizeof(size));
+    return w.size();
+}
+
+bool Bus::loadState(std::span<const uint8_t> in) {
+    StateHeader header;
+    if (in.size() < sizeof(header)) {
+        std::cerr << "Save state is truncated\n";
+        return false;
+    }
+    std::memcpy(&header, in.data(), sizeof(header));
+    if (header.magic != STATE_MAGIC || header.version != STATE_VERSION) {
+        std::cerr << "Save state has an unsupported format (version " << header.version << ")\n";
+        return false;
+    }
+    // Same version and size means the same components and cartridge RAM, so
+    // the reads below cannot run short
+    if (header.size != in.size() || in.size() != stateSize()) {
+        std::cerr << "Save state does not match this system\n";
+        return false;
+    }
+
+    StateReader r(in);
+    r.pod(header);
+    r.pod(ram);
+    r.pod(systemClock); r.pod(ppuClock); r.pod(apuClock); r.pod(cpuTime);
+    r.pod(ppuWritten);
+    r.pod(dmaActive); r.pod(dmaSync); r.pod(dmaPage); r.pod(dmaAddr); r.pod(dmaData);
+    if (cpu) cpu->loadState(r);
+    if (ppu) ppu->loadState(r);
+    if (apu) apu->loadState(r);
+    if (cartridge) cartridge->loadState(r);
+    if (ctrl1) ctrl1->loadState(r);
+    if (ctrl2) ctrl2->loadState(r);
+
+    // RAM and PRG-RAM changed behind the page tables: blocks decoded from
+    // them must recheck. PRG-ROM is never written, so blocks (and their
+    // native code) there stay valid across restores.
+    for (int slot = 0; slot < 0x08; slot++) versions[slot]++;
+    for (int page = 0x60; page < 0x80; page++) {
+        if (readPages[page]) versions[page]++;
+    }
+    epoch++;
+    return true;
+}
@@ -1,12 +1,15 @@
 #pragma once
 #include <cstdint>
+#include <cstddef>
 #include <array>
+#include <span>
 
 class CPU;
 class PPU;
 class APU;
 class Cartridge;
 class Controller;
+class StateWriter;
 
 class Bus {
 public:
@@ -15,18 +18,55 @@ public:
     void connectCPU(CPU* c) { cpu = c; }
     void connectPPU(PPU* p) { ppu = p; }
     void connectAPU(APU* a) { apu = a; }
-    void connectCartridge(Cartridge* c) { cartridge = c; }
+    void connectCartridge(Cartridge* c);
     void connectController(Controller* c1, Controller* c2) { ctrl1 = c1; ctrl2 = c2; }
 
-    // CPU reads/writes go through the bus
-    uint8_t cpuRead(uint16_t addr);
-    void cpuWrite(uint16_t addr, uint8_t val);
+    // CPU reads/writes go through the bus. Pages backed by plain memory (RAM,
+    // PRG-ROM, PRG-RAM) are served straight from the page tables; everything
+    // else takes the I/O path.
+    uint8_t cpuRead(uint16_t addr) {
+        const uint8_t* page = readPages[addr >> 8];
+        return page ? page[addr & 0xFF] : ioRead(addr);
+    }
+    void cpuWrite(uint16_t addr, uint8_t val) {
+        uint8_t* page = writePages[addr >> 8];
+        if (page) page[addr & 0xFF] = val;
+        else ioWrite(addr, val);
+    }
 
-    // System clock
+    // Re-read the cartridge's PRG mapping into the page tables. Mappers call
+    // this after a bank switch.
+    void remapCartridge();
+
+    // For the CPU block cache: the memory behind a page (nullptr for I/O), and
+    // a version that changes whenever the page's contents may have
+    // changed. watchPage() sends writes to a RAM page through the slow path so
+    // they can bump its version.
+    const uint8_t* readPage(uint8_t page) const { return readPages[page]; }
+    uint32_t pageVersion(uint8_t page) const { return versions[versionSlot(page)]; }
+    uint32_t versionEpoch() const { return epoch; } // changes with any version
+    void watchPage(uint8_t page);
+
+    // The raw page tables, for code generated against them (see jit.h)
+    const uint8_t* const* readTable() const { return readPages.data(); }
+    uint8_t* const* writeTable() const { return writePages.data(); }
+
+    // Advance the system. Runs CPU instructions back to back and lets the
+    // PPU/APU catch up lazily; returns at vblank so ppu.isFrameReady() can be
+    // polled exactly as with per-dot clocking.
     void clock();
 
     uint64_t totalCycles() const { return systemClock; }
 
+    // Whole-system save state: every connected component plus the bus's own
+    // RAM, clocks and DMA progress, as one flat versioned snapshot.
+    // saveState() returns the bytes written (0 if `out` is smaller than
+    // stateSize()); loadState() leaves everything untouched and returns false
+    // unless the snapshot has this build's version and this system's size.
+    size_t stateSize() const;
+    size_t saveState(std::span<uint8_t> out) const;
+    bool loadState(std::span<const uint8_t> in);
+
 private:
     CPU* cpu = nullptr;
     PPU* ppu = nullptr;
@@ -38,7 +78,35 @@ private:
     // 2KB internal RAM
     std::array<uint8_t, 2048> ram{};
 
+    // CPU memory map, one entry per 256-byte page; nullptr = I/O handler
+    std::array<const uint8_t*, 256> readPages{};
+    std::array<uint8_t*, 256> writePages{};
+
+    uint8_t ioRead(uint16_t addr);
+    void ioWrite(uint16_t addr, uint8_t val);
+
+    // Page versions; the four RAM mirrors share one slot per page
+    std::array<uint32_t, 256> versions{};
+    uint32_t epoch = 0;
+    static uint8_t versionSlot(uint8_t page) { return page < 0x20 ? (page & 0x07) : page; }
+    bool ioAccess = false; // raised by every slow-path access; ends a CPU block
+
+    // Master clock in PPU dots. systemClock is the next dot to run; the PPU
+    // and APU trail behind it and are brought up to date on demand.
     uint64_t systemClock = 0;
+    uint64_t ppuClock = 0;   // next dot the PPU has not run yet
+    uint64_t apuClock = 0;   // next CPU-aligned dot the APU has not run yet
+    uint64_t cpuTime = 0;    // dot of the instruction currently executing
+    bool ppuWritten = false; // a PPU register changed; vblank may have moved
+
+    void writeState(StateWriter& w) const;
+
+    // Lock-step single dot (used while OAM DMA is stalling the CPU)
+    void tick();
+
+    void syncPPU(uint64_t dot);   // run the PPU through `dot` inclusive
+    void syncAPU(uint64_t dot);   // run the APU for CPU cycles before `dot`
+    void pollNMI();
 
     // DMA
     bool dmaActive = false;
@@ -1,6 +1,11 @@
 #include "cartridge.h"
+#include "bus.h"
+#include "state.h"
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <cstring>
 
 bool Cartridge::load(const std::string& path) {
     std::ifstream file(path, std::ios::binary);
@@ -9,9 +14,18 @@ bool Cartridge::load(const std::string& path) {
         return false;
     }
 
+    std::vector<uint8_t> image((std::istreambuf_iterator<char>(file)),
+                               std::istreambuf_iterator<char>());
+    return loadFromMemory(image);
+}
+
+bool Cartridge::loadFromMemory(const std::vector<uint8_t>& image) {
     // iNES header (16 bytes)
-    uint8_t header[16];
-    file.read(reinterpret_cast<char*>(header), 16);
+    if (image.size() < 16) {
+        std::cerr << "Invalid iNES header\n";
+        return false;
+    }
+    const uint8_t* header = image.data();
 
     // Verify "NES\x1A" magic
     if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A) {
@@ -34,23 +48,43 @@ bool Cartridge::load(const std::string& path) {
     else
         mirrorMode = MirrorMode::Horizontal;
 
+    size_t offset = 16;
+
     // Skip trainer if present
     if (flags6 & 0x04) {
-        file.seekg(512, std::ios::cur);
+        offset += 512;
     }
 
+    // Copy as much of a section as the image holds; short files leave zeros
+    auto readSection = [&](std::vector<uint8_t>& dst) {
+        size_t avail = offset < image.size() ? image.size() - offset : 0;
+        size_t n = std::min(avail, dst.size());
+        if (n) std::copy_n(image.begin() + offset, n, dst.begin()); // offset may be past the end
+        offset += dst.size();
+    };
+
     // Read PRG ROM
-    prgRom.resize(prgBanks * 16384);
-    file.read(reinterpret_cast<char*>(prgRom.data()), prgRom.size());
+    prgRom.assign(prgBanks * 16384, 0);
+    readSection(prgRom);
 
     // Read CHR ROM (or allocate CHR RAM)
     if (chrBanks == 0) {
-        chrRom.resize(8192, 0); // 8KB CHR-RAM
+        chrRom.assign(8192, 0); // 8KB CHR-RAM
     } else {
-        chrRom.resize(chrBanks * 8192);
-        file.read(reinterpret_cast<char*>(chrRom.data()), chrRom.size());
+        chrRom.assign(chrBanks * 8192, 0);
+        readSection(chrRom);
+    }
+
+    chrRows.assign(chrRom.size() / 2, TileRow{});
+    for (uint32_t offset = 0; offset < chrRom.size(); offset += 16) {
+        for (uint32_t row = 0; row < 8; row++) {
+            decodeRow(offset + row);
+        }
     }
 
+    // Battery-backed PRG-RAM
+    prgRam.assign((flags6 & 0x02) ? 8192 : 0, 0);
+
     std::cout << "Loaded ROM: PRG=" << (int)prgBanks << "x16KB, CHR=" << (int)chrBanks
               << "x8KB, Mapper=" << (int)mapper << "\n";
 
@@ -58,27 +92,54 @@ bool Cartridge::load(const std::string& path) {
         std::cerr << "Warning: Only Mapper 0 (NROM) is supported\n";
     }
 
+    if (bus) bus->remapCartridge();
     return true;
 }
 
+uint32_t Cartridge::prgAddress(uint16_t addr) const {
+    uint32_t mapped = addr - 0x8000;
+    if (prgBanks == 1) mapped &= 0x3FFF; // Mirror 16KB
+    return mapped % prgRom.size();
+}
+
 uint8_t Cartridge::cpuRead(uint16_t addr) const {
-    // Mapper 0: $8000-$BFFF = first 16KB, $C000-$FFFF = last 16KB (or mirror)
     if (addr >= 0x8000) {
-        uint32_t mapped = addr - 0x8000;
-        if (prgBanks == 1) mapped &= 0x3FFF; // Mirror 16KB
-        return prgRom[mapped % prgRom.size()];
+        return prgRom.empty() ? 0 : prgRom[prgAddress(addr)];
+    }
+    if (addr >= 0x6000 && !prgRam.empty()) {
+        return prgRam[addr - 0x6000];
     }
     return 0;
 }
 
 void Cartridge::cpuWrite(uint16_t addr, uint8_t val) {
-    // Mapper 0 has no writable PRG
-    (void)addr; (void)val;
+    // Mapper 0 has no writable PRG-ROM
+    if (addr >= 0x6000 && addr < 0x8000 && !prgRam.empty()) {
+        prgRam[addr - 0x6000] = val;
+    }
+}
+
+const uint8_t* Cartridge::cpuReadPage(uint8_t page) const {
+    // prgAddress() never splits a page, so whole pages can be handed out
+    if (page >= 0x80) {
+        return prgRom.empty() ? nullptr : &prgRom[prgAddress((uint16_t)(page << 8))];
+    }
+    if (page >= 0x60 && !prgRam.empty()) {
+        return &prgRam[(page - 0x60) << 8];
+    }
+    return nullptr;
+}
+
+uint8_t* Cartridge::cpuWritePage(uint8_t page) {
+    if (page >= 0x60 && page < 0x80 && !prgRam.empty()) {
+        return &prgRam[(page - 0x60) << 8];
+    }
+    return nullptr;
 }
 
 uint8_t Cartridge::ppuRead(uint16_t addr) const {
     if (addr < 0x2000) {
-        return chrRom[addr % chrRom.size()];
+        return chrRom[chrAddress(addr)];
     }
     return 0;
 }
@@ -86,6 +147,52 @@ uint8_t Cartridge::ppuRead(uint16_t addr) const {
 void Cartridge::ppuWrite(uint16_t addr, uint8_t val) {
     // CHR-RAM is writable
     if (addr < 0x2000 && chrBanks == 0) {
-        chrRom[addr % chrRom.size()] = const_cast<uint8_t&>(chrRom[addr % chrRom.size()]) = val;
+        uint32_t offset = chrAddress(addr);
+        chrRom[offset] = val;
+        decodeRow(offset & ~0x08u); // either plane changes the same row
+    }
+}
+
+uint16_t Cartridge::packRow(uint8_t lo, uint8_t hi) {
+    uint16_t packed = 0;
+    for (int i = 0; i < 8; i++) {
+        uint16_t px = ((lo >> (7 - i)) & 1) | (((hi >> (7 - i)) & 1) << 1);
+        packed |= px << (14 - 2 * i);
+    }
+    return packed;
+}
+
+void Cartridge::decodeRow(uint32_t offset) {
+    uint8_t lo = chrRom[offset];
+    uint8_t hi = chrRom[offset + 8];
+
+    TileRow& row = chrRows[((offset >> 4) << 3) | (offset & 7)];
+    row.lo = lo;
+    row.hi = hi;
+    row.plain = packRow(lo, hi);
+    row.flipped = 0;
+    for (int i = 0; i < 8; i++) {
+        row.flipped |= ((row.plain >> (14 - 2 * i)) & 3) << (2 * i);
+    }
+}
+
+void Cartridge::saveState(StateWriter& w) const {
+    w.bytes(prgRam.data(), prgRam.size());
+    if (chrBanks == 0) w.bytes(chrRom.data(), chrRom.size());
+}
+
+void Cartridge::loadState(StateReader& r) {
+    r.bytes(prgRam.data(), prgRam.size());
+    if (chrBanks == 0) {
+        // Only tiles that differ need their rows decoded again
+        uint8_t tile[16];
+        for (uint32_t offset = 0; offset < chrRom.size(); offset += 16) {
+            r.bytes(tile, sizeof(tile));
+            if (std::memcmp(tile, &chrRom[offset], sizeof(tile)) == 0) continue;
+            std::memcpy(&chrRom[offset], tile, sizeof(tile));
+            for (uint32_t row = 0; row < 8; row++) {
+                decodeRow(offset + row);
+            }
+        }
     }
 }
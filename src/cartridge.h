@@ -3,28 +3,70 @@
 #include <string>
 #include <vector>
 
+class Bus;
+class StateWriter;
+class StateReader;
+
 enum class MirrorMode { Horizontal, Vertical, FourScreen };
 
 class Cartridge {
 public:
     bool load(const std::string& path);
+    bool loadFromMemory(const std::vector<uint8_t>& image); // full iNES image
+
+    // The bus is told to rebuild its page tables whenever the PRG mapping
+    // changes (load, bank switch)
+    void connectBus(Bus* b) { bus = b; }
 
-    // CPU-side access (PRG ROM)
+    // CPU-side access (PRG ROM/RAM)
     uint8_t cpuRead(uint16_t addr) const;
     void cpuWrite(uint16_t addr, uint8_t val);
 
+    // Memory backing a 256-byte CPU page ($40-$FF), or nullptr if the page
+    // needs cpuRead/cpuWrite
+    const uint8_t* cpuReadPage(uint8_t page) const;
+    uint8_t* cpuWritePage(uint8_t page);
+
     // PPU-side access (CHR ROM/RAM)
     uint8_t ppuRead(uint16_t addr) const;
     void ppuWrite(uint16_t addr, uint8_t val);
 
+    // Pre-decoded pattern rows. Keyed by physical CHR offset, so a bank switch
+    // only changes chrAddress(); CHR-RAM writes re-decode the row they hit.
+    struct TileRow {
+        uint16_t plain;   // 8 pixels x 2 bits, leftmost pixel in bits 15-14
+        uint16_t flipped; // the same row mirrored horizontally
+        uint8_t lo, hi;   // raw bit planes
+    };
+    // addr = pattern row address ($0000-$1FFF, plane 0)
+    const TileRow& tileRow(uint16_t addr) const {
+        uint32_t offset = chrAddress(addr);
+        return chrRows[((offset >> 4) << 3) | (offset & 7)];
+    }
+    static uint16_t packRow(uint8_t lo, uint8_t hi);
+
+    // Save states (layout in state.h): PRG-RAM and CHR-RAM only, the ROM
+    // itself is never written
+    void saveState(StateWriter& w) const;
+    void loadState(StateReader& r);
+
     MirrorMode mirror() const { return mirrorMode; }
     uint8_t mapperId() const { return mapper; }
 
 private:
     std::vector<uint8_t> prgRom;
     std::vector<uint8_t> chrRom; // may be RAM if 0 CHR banks
+    std::vector<uint8_t> prgRam; // 8KB at $6000 if the battery flag is set
+    std::vector<TileRow> chrRows; // 8 per 16-byte tile
+
+    // Mapper 0: one fixed 8KB CHR bank (chrRom is always at least 8KB)
+    uint32_t chrAddress(uint16_t addr) const { return addr & 0x1FFF; }
+    // Mapper 0: $8000-$BFFF = first 16KB, $C000-$FFFF = last 16KB (or mirror)
+    uint32_t prgAddress(uint16_t addr) const;
+    void decodeRow(uint32_t offset);
     uint8_t prgBanks = 0;
     uint8_t chrBanks = 0;
     uint8_t mapper = 0;
     MirrorMode mirrorMode = MirrorMode::Horizontal;
+    Bus* bus = nullptr;
 };
@@ -0,0 +1,31 @@
+#include "console.h"
+
+Console::Console() {
+    bus.connectCPU(&cpu);
+    bus.connectPPU(&ppu);
+    bus.connectAPU(&apu);
+    bus.connectCartridge(&cartridge);
+    bus.connectController(&ctrl1, &ctrl2);
+    cpu.connectBus(&bus);
+    ppu.connectCartridge(&cartridge);
+}
+
+bool Console::load(const std::string& path) {
+    if (!cartridge.load(path)) return false;
+    cpu.reset();
+    return true;
+}
+
+bool Console::loadFromMemory(const std::vector<uint8_t>& image) {
+    if (!cartridge.loadFromMemory(image)) return false;
+    cpu.reset();
+    return true;
+}
+
+void Console::runFrame() {
+    ppu.clearFrameReady();
+    while (!ppu.isFrameReady()) {
+        bus.clock();
+    }
+    apu.flushSamples();
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "bus.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "cartridge.h"
+#include "controller.h"
+
+// One complete NES: owns every component and wires them to each other. All
+// emulation state lives in these objects (nothing is static or global), so any
+// number of consoles can run in one process, each on its own thread. A single
+// console must only be driven from one thread at a time.
+//
+// The components point at each other, so a Console is neither copyable nor
+// movable; hold it by unique_ptr to keep it in a container.
+class Console {
+public:
+    Console();
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    // Load a ROM and reset the CPU. False (with the reason on stderr) if the
+    // image can't be read or isn't iNES.
+    bool load(const std::string& path);
+    bool loadFromMemory(const std::vector<uint8_t>& image);
+
+    void reset() { cpu.reset(); }
+
+    // Run until the PPU finishes the next frame
+    void runFrame();
+
+    // Palette indices and per-line emphasis; see palette.h
+    const uint8_t* frameBuffer() const { return ppu.getFrameBuffer(); }
+    const uint8_t* lineEmphasis() const { return ppu.getLineEmphasis(); }
+
+    Cartridge cartridge;
+    CPU cpu;
+    PPU ppu;
+    APU apu;
+    Bus bus;
+    Controller ctrl1, ctrl2;
+};
@@ -1,4 +1,5 @@
 #include "controller.h"
+#include "state.h"
 
 void Controller::write(uint8_t val) {
     strobe = (val & 1);
@@ -17,3 +18,11 @@ uint8_t Controller::read() {
     }
     return bit | 0x40; // open bus bits
 }
+
+void Controller::saveState(StateWriter& w) const {
+    w.pod(buttons); w.pod(shifter); w.pod(strobe);
+}
+
+void Controller::loadState(StateReader& r) {
+    r.pod(buttons); r.pod(shifter); r.pod(strobe);
+}
@@ -1,6 +1,9 @@
 #pragma once
 #include <cstdint>
 
+class StateWriter;
+class StateReader;
+
 class Controller {
 public:
     enum Button : uint8_t {
@@ -20,6 +23,10 @@ public:
     void write(uint8_t val);
     uint8_t read();
 
+    // Save states (layout in state.h)
+    void saveState(StateWriter& w) const;
+    void loadState(StateReader& r);
+
 private:
     uint8_t buttons = 0;   // current button state
     uint8_t shifter = 0;   // shift register
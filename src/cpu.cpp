@@ -1,10 +1,21 @@
 #include "cpu.h"
 #include "bus.h"
+#include "opcodes.h"
+#include "state.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+using namespace opcodes;
 
 CPU::CPU() {
     reset();
 }
 
+CPU::~CPU() = default;
+
 uint8_t CPU::read(uint16_t addr) {
     return bus ? bus->cpuRead(addr) : 0;
 }
@@ -97,717 +108,507 @@ void CPU::clock() {
     cycles--;  // account for the cycle we just used
 }
 
+int CPU::step() {
+    execute();
+    int taken = cycles;
+    cycles = 0;
+    return taken;
+}
+
+// ===================== Execution =====================
+
 void CPU::execute() {
+    using Handler = void (*)(CPU&);
+    static constexpr auto handlers = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<Handler, 256>{[](CPU& cpu) { cpu.execOp<I>(); }...};
+    }(std::make_index_sequence<256>{});
+
     uint8_t opcode = read(pc++);
+    handlers[opcode](*this);
+}
 
-    // Decode addressing mode and get operand address
-    uint16_t addr = 0;
-    bool extraCycle = false;
-
-    // Helper lambdas for common addressing
-    auto imm = [&]() -> uint16_t { return pc++; };
-    auto zp  = [&]() -> uint16_t { return read(pc++) & 0xFF; };
-    auto zpx = [&]() -> uint16_t { return (read(pc++) + x) & 0xFF; };
-    auto zpy = [&]() -> uint16_t { return (read(pc++) + y) & 0xFF; };
-    auto abs_ = [&]() -> uint16_t {
-        uint16_t lo = read(pc++);
-        uint16_t hi = read(pc++);
-        return (hi << 8) | lo;
-    };
-    auto abx = [&](bool checkPage = true) -> uint16_t {
-        uint16_t lo = read(pc++);
-        uint16_t hi = read(pc++);
-        uint16_t base = (hi << 8) | lo;
-        uint16_t result = base + x;
-        if (checkPage && pageCross(base, result)) extraCycle = true;
-        return result;
+// Cached == true runs a decoded instruction: pc is already past the bytes
+// the addressing mode reads, and `operand` holds them instead
+template <uint8_t Opcode, bool Cached>
+void CPU::execOp(uint16_t operand) {
+    constexpr OpInfo info = opTable[Opcode];
+    cycles = info.cycles;
+
+    auto fetch = [&]() -> uint8_t {
+        if constexpr (Cached) {
+            uint8_t b = operand & 0xFF;
+            operand >>= 8;
+            return b;
+        } else {
+            return read(pc++);
+        }
     };
-    auto aby = [&](bool checkPage = true) -> uint16_t {
-        uint16_t lo = read(pc++);
-        uint16_t hi = read(pc++);
-        uint16_t base = (hi << 8) | lo;
-        uint16_t result = base + y;
-        if (checkPage && pageCross(base, result)) extraCycle = true;
+
+    // Operand address
+    uint16_t addr = 0;
+    auto indexed = [&](uint16_t base, uint8_t index) -> uint16_t {
+        uint16_t result = base + index;
+        if (info.pagePenalty && pageCross(base, result)) cycles++;
         return result;
     };
-    auto izx = [&]() -> uint16_t {
-        uint8_t ptr = read(pc++) + x;
-        uint16_t lo = read(ptr & 0xFF);
+    if constexpr (info.mode == AddrMode::IMM || info.mode == AddrMode::REL) {
+        addr = Cached ? pc - 1 : pc++;
+    } else if constexpr (info.mode == AddrMode::ZP) {
+        addr = fetch();
+    } else if constexpr (info.mode == AddrMode::ZPX) {
+        addr = (fetch() + x) & 0xFF;
+    } else if constexpr (info.mode == AddrMode::ZPY) {
+        addr = (fetch() + y) & 0xFF;
+    } else if constexpr (info.mode == AddrMode::ABS || info.mode == AddrMode::IND) {
+        uint16_t lo = fetch();
+        uint16_t hi = fetch();
+        addr = (hi << 8) | lo;
+    } else if constexpr (info.mode == AddrMode::ABX || info.mode == AddrMode::ABY) {
+        uint16_t lo = fetch();
+        uint16_t hi = fetch();
+        addr = indexed((hi << 8) | lo, info.mode == AddrMode::ABX ? x : y);
+    } else if constexpr (info.mode == AddrMode::IZX) {
+        uint8_t ptr = fetch() + x;
+        uint16_t lo = read(ptr);
         uint16_t hi = read((ptr + 1) & 0xFF);
-        return (hi << 8) | lo;
-    };
-    auto izy = [&](bool checkPage = true) -> uint16_t {
-        uint8_t ptr = read(pc++);
-        uint16_t lo = read(ptr & 0xFF);
+        addr = (hi << 8) | lo;
+    } else if constexpr (info.mode == AddrMode::IZY) {
+        uint8_t ptr = fetch();
+        uint16_t lo = read(ptr);
         uint16_t hi = read((ptr + 1) & 0xFF);
-        uint16_t base = (hi << 8) | lo;
-        uint16_t result = base + y;
-        if (checkPage && pageCross(base, result)) extraCycle = true;
-        return result;
-    };
-
-    switch (opcode) {
-        // ===== ADC =====
-        case 0x69: { addr = imm(); cycles = 2; goto do_adc; }
-        case 0x65: { addr = zp();  cycles = 3; goto do_adc; }
-        case 0x75: { addr = zpx(); cycles = 4; goto do_adc; }
-        case 0x6D: { addr = abs_(); cycles = 4; goto do_adc; }
-        case 0x7D: { addr = abx(); cycles = 4; goto do_adc; }
-        case 0x79: { addr = aby(); cycles = 4; goto do_adc; }
-        case 0x61: { addr = izx(); cycles = 6; goto do_adc; }
-        case 0x71: { addr = izy(); cycles = 5;
-            do_adc: {
-                uint8_t m = read(addr);
-                uint16_t sum = a + m + (flagC ? 1 : 0);
-                flagC = sum > 0xFF;
-                flagV = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
-                a = sum & 0xFF;
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-            }
-        }
-
-        // ===== SBC =====
-        case 0xE9: { addr = imm(); cycles = 2; goto do_sbc; }
-        case 0xE5: { addr = zp();  cycles = 3; goto do_sbc; }
-        case 0xF5: { addr = zpx(); cycles = 4; goto do_sbc; }
-        case 0xED: { addr = abs_(); cycles = 4; goto do_sbc; }
-        case 0xFD: { addr = abx(); cycles = 4; goto do_sbc; }
-        case 0xF9: { addr = aby(); cycles = 4; goto do_sbc; }
-        case 0xE1: { addr = izx(); cycles = 6; goto do_sbc; }
-        case 0xF1: { addr = izy(); cycles = 5;
-            do_sbc: {
-                uint8_t m = read(addr) ^ 0xFF;
-                uint16_t sum = a + m + (flagC ? 1 : 0);
-                flagC = sum > 0xFF;
-                flagV = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
-                a = sum & 0xFF;
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-            }
-        }
-
-        // ===== AND =====
-        case 0x29: { addr = imm(); cycles = 2; goto do_and; }
-        case 0x25: { addr = zp();  cycles = 3; goto do_and; }
-        case 0x35: { addr = zpx(); cycles = 4; goto do_and; }
-        case 0x2D: { addr = abs_(); cycles = 4; goto do_and; }
-        case 0x3D: { addr = abx(); cycles = 4; goto do_and; }
-        case 0x39: { addr = aby(); cycles = 4; goto do_and; }
-        case 0x21: { addr = izx(); cycles = 6; goto do_and; }
-        case 0x31: { addr = izy(); cycles = 5;
-            do_and:
-                a &= read(addr);
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-        }
-
-        // ===== ORA =====
-        case 0x09: { addr = imm(); cycles = 2; goto do_ora; }
-        case 0x05: { addr = zp();  cycles = 3; goto do_ora; }
-        case 0x15: { addr = zpx(); cycles = 4; goto do_ora; }
-        case 0x0D: { addr = abs_(); cycles = 4; goto do_ora; }
-        case 0x1D: { addr = abx(); cycles = 4; goto do_ora; }
-        case 0x19: { addr = aby(); cycles = 4; goto do_ora; }
-        case 0x01: { addr = izx(); cycles = 6; goto do_ora; }
-        case 0x11: { addr = izy(); cycles = 5;
-            do_ora:
-                a |= read(addr);
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-        }
-
-        // ===== EOR =====
-        case 0x49: { addr = imm(); cycles = 2; goto do_eor; }
-        case 0x45: { addr = zp();  cycles = 3; goto do_eor; }
-        case 0x55: { addr = zpx(); cycles = 4; goto do_eor; }
-        case 0x4D: { addr = abs_(); cycles = 4; goto do_eor; }
-        case 0x5D: { addr = abx(); cycles = 4; goto do_eor; }
-        case 0x59: { addr = aby(); cycles = 4; goto do_eor; }
-        case 0x41: { addr = izx(); cycles = 6; goto do_eor; }
-        case 0x51: { addr = izy(); cycles = 5;
-            do_eor:
-                a ^= read(addr);
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-        }
-
-        // ===== CMP =====
-        case 0xC9: { addr = imm(); cycles = 2; goto do_cmp; }
-        case 0xC5: { addr = zp();  cycles = 3; goto do_cmp; }
-        case 0xD5: { addr = zpx(); cycles = 4; goto do_cmp; }
-        case 0xCD: { addr = abs_(); cycles = 4; goto do_cmp; }
-        case 0xDD: { addr = abx(); cycles = 4; goto do_cmp; }
-        case 0xD9: { addr = aby(); cycles = 4; goto do_cmp; }
-        case 0xC1: { addr = izx(); cycles = 6; goto do_cmp; }
-        case 0xD1: { addr = izy(); cycles = 5;
-            do_cmp: {
-                uint8_t m = read(addr);
-                flagC = a >= m;
-                setZN(a - m);
-                if (extraCycle) cycles++;
-                break;
-            }
-        }
-
-        // ===== CPX =====
-        case 0xE0: { addr = imm(); cycles = 2; goto do_cpx; }
-        case 0xE4: { addr = zp();  cycles = 3; goto do_cpx; }
-        case 0xEC: { addr = abs_(); cycles = 4;
-            do_cpx: {
-                uint8_t m = read(addr);
-                flagC = x >= m;
-                setZN(x - m);
-                break;
-            }
-        }
-
-        // ===== CPY =====
-        case 0xC0: { addr = imm(); cycles = 2; goto do_cpy; }
-        case 0xC4: { addr = zp();  cycles = 3; goto do_cpy; }
-        case 0xCC: { addr = abs_(); cycles = 4;
-            do_cpy: {
-                uint8_t m = read(addr);
-                flagC = y >= m;
-                setZN(y - m);
-                break;
-            }
-        }
-
-        // ===== BIT =====
-        case 0x24: { addr = zp();  cycles = 3; goto do_bit; }
-        case 0x2C: { addr = abs_(); cycles = 4;
-            do_bit: {
-                uint8_t m = read(addr);
-                flagZ = (a & m) == 0;
-                flagV = (m & 0x40) != 0;
-                flagN = (m & 0x80) != 0;
-                break;
-            }
-        }
-
-        // ===== LDA =====
-        case 0xA9: { addr = imm(); cycles = 2; goto do_lda; }
-        case 0xA5: { addr = zp();  cycles = 3; goto do_lda; }
-        case 0xB5: { addr = zpx(); cycles = 4; goto do_lda; }
-        case 0xAD: { addr = abs_(); cycles = 4; goto do_lda; }
-        case 0xBD: { addr = abx(); cycles = 4; goto do_lda; }
-        case 0xB9: { addr = aby(); cycles = 4; goto do_lda; }
-        case 0xA1: { addr = izx(); cycles = 6; goto do_lda; }
-        case 0xB1: { addr = izy(); cycles = 5;
-            do_lda:
-                a = read(addr);
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
-        }
-
-        // ===== LDX =====
-        case 0xA2: { addr = imm(); cycles = 2; goto do_ldx; }
-        case 0xA6: { addr = zp();  cycles = 3; goto do_ldx; }
-        case 0xB6: { addr = zpy(); cycles = 4; goto do_ldx; }
-        case 0xAE: { addr = abs_(); cycles = 4; goto do_ldx; }
-        case 0xBE: { addr = aby(); cycles = 4;
-            do_ldx:
-                x = read(addr);
-                setZN(x);
-                if (extraCycle) cycles++;
-                break;
-        }
-
-        // ===== LDY =====
-        case 0xA0: { addr = imm(); cycles = 2; goto do_ldy; }
-        case 0xA4: { addr = zp();  cycles = 3; goto do_ldy; }
-        case 0xB4: { addr = zpx(); cycles = 4; goto do_ldy; }
-        case 0xAC: { addr = abs_(); cycles = 4; goto do_ldy; }
-        case 0xBC: { addr = abx(); cycles = 4;
-            do_ldy:
-                y = read(addr);
-                setZN(y);
-                if (extraCycle) cycles++;
-                break;
-        }
+        addr = indexed((hi << 8) | lo, y);
+    }
 
-        // ===== STA =====
-        case 0x85: { addr = zp();  cycles = 3; goto do_sta; }
-        case 0x95: { addr = zpx(); cycles = 4; goto do_sta; }
-        case 0x8D: { addr = abs_(); cycles = 4; goto do_sta; }
-        case 0x9D: { addr = abx(false); cycles = 5; goto do_sta; }
-        case 0x99: { addr = aby(false); cycles = 5; goto do_sta; }
-        case 0x81: { addr = izx(); cycles = 6; goto do_sta; }
-        case 0x91: { addr = izy(false); cycles = 6;
-            do_sta:
-                write(addr, a);
-                break;
+    // The operand value; decoded immediates skip the bus
+    auto load = [&]() -> uint8_t {
+        if constexpr (Cached && (info.mode == AddrMode::IMM || info.mode == AddrMode::REL)) {
+            return operand & 0xFF;
+        } else {
+            return read(addr);
         }
+    };
 
-        // ===== STX =====
-        case 0x86: { addr = zp();  cycles = 3; goto do_stx; }
-        case 0x96: { addr = zpy(); cycles = 4; goto do_stx; }
-        case 0x8E: { addr = abs_(); cycles = 4;
-            do_stx:
-                write(addr, x);
-                break;
+    // Shared bodies
+    auto adc = [&](uint8_t m) {
+        uint16_t sum = a + m + (flagC ? 1 : 0);
+        flagC = sum > 0xFF;
+        flagV = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
+        a = sum & 0xFF;
+        setZN(a);
+    };
+    auto compare = [&](uint8_t reg) {
+        uint8_t m = load();
+        flagC = reg >= m;
+        setZN(reg - m);
+    };
+    auto branch = [&](bool taken) {
+        int8_t off = (int8_t)load();
+        if (taken) {
+            uint16_t newPC = pc + off;
+            cycles += pageCross(pc, newPC) ? 2 : 1;
+            pc = newPC;
         }
-
-        // ===== STY =====
-        case 0x84: { addr = zp();  cycles = 3; goto do_sty; }
-        case 0x94: { addr = zpx(); cycles = 4; goto do_sty; }
-        case 0x8C: { addr = abs_(); cycles = 4;
-            do_sty:
-                write(addr, y);
-                break;
+    };
+    // Shifts and rotates work on A or on memory
+    auto modify = [&](auto fn) -> uint8_t {
+        if constexpr (info.mode == AddrMode::ACC) {
+            a = fn(a);
+            setZN(a);
+            return a;
+        } else {
+            uint8_t m = fn(read(addr));
+            write(addr, m);
+            return m;
         }
+    };
+    auto asl = [&](uint8_t m) -> uint8_t { flagC = (m & 0x80) != 0; return m << 1; };
+    auto lsr = [&](uint8_t m) -> uint8_t { flagC = (m & 0x01) != 0; return m >> 1; };
+    auto rol = [&](uint8_t m) -> uint8_t {
+        bool oldC = flagC;
+        flagC = (m & 0x80) != 0;
+        return (m << 1) | (oldC ? 1 : 0);
+    };
+    auto ror = [&](uint8_t m) -> uint8_t {
+        bool oldC = flagC;
+        flagC = (m & 0x01) != 0;
+        return (m >> 1) | (oldC ? 0x80 : 0);
+    };
 
-        // ===== INC =====
-        case 0xE6: { addr = zp();  cycles = 5; goto do_inc; }
-        case 0xF6: { addr = zpx(); cycles = 6; goto do_inc; }
-        case 0xEE: { addr = abs_(); cycles = 6; goto do_inc; }
-        case 0xFE: { addr = abx(false); cycles = 7;
-            do_inc: {
-                uint8_t m = read(addr) + 1;
-                write(addr, m);
-                setZN(m);
-                break;
-            }
+    if constexpr (info.op == Op::ADC) { adc(load()); }
+    else if constexpr (info.op == Op::SBC) { adc(load() ^ 0xFF); }
+    else if constexpr (info.op == Op::AND) { a &= load(); setZN(a); }
+    else if constexpr (info.op == Op::ORA) { a |= load(); setZN(a); }
+    else if constexpr (info.op == Op::EOR) { a ^= load(); setZN(a); }
+    else if constexpr (info.op == Op::CMP) { compare(a); }
+    else if constexpr (info.op == Op::CPX) { compare(x); }
+    else if constexpr (info.op == Op::CPY) { compare(y); }
+    else if constexpr (info.op == Op::BIT) {
+        uint8_t m = read(addr);
+        flagZ = (a & m) == 0;
+        flagV = (m & 0x40) != 0;
+        flagN = (m & 0x80) != 0;
+    }
+    else if constexpr (info.op == Op::LDA) { a = load(); setZN(a); }
+    else if constexpr (info.op == Op::LDX) { x = load(); setZN(x); }
+    else if constexpr (info.op == Op::LDY) { y = load(); setZN(y); }
+    else if constexpr (info.op == Op::STA) { write(addr, a); }
+    else if constexpr (info.op == Op::STX) { write(addr, x); }
+    else if constexpr (info.op == Op::STY) { write(addr, y); }
+    else if constexpr (info.op == Op::INC) {
+        uint8_t m = read(addr) + 1;
+        write(addr, m);
+        setZN(m);
+    }
+    else if constexpr (info.op == Op::DEC) {
+        uint8_t m = read(addr) - 1;
+        write(addr, m);
+        setZN(m);
+    }
+    else if constexpr (info.op == Op::INX) { x++; setZN(x); }
+    else if constexpr (info.op == Op::INY) { y++; setZN(y); }
+    else if constexpr (info.op == Op::DEX) { x--; setZN(x); }
+    else if constexpr (info.op == Op::DEY) { y--; setZN(y); }
+    else if constexpr (info.op == Op::ASL) { setZN(modify(asl)); }
+    else if constexpr (info.op == Op::LSR) { setZN(modify(lsr)); }
+    else if constexpr (info.op == Op::ROL) { setZN(modify(rol)); }
+    else if constexpr (info.op == Op::ROR) { setZN(modify(ror)); }
+    else if constexpr (info.op == Op::BCC) { branch(!flagC); }
+    else if constexpr (info.op == Op::BCS) { branch(flagC); }
+    else if constexpr (info.op == Op::BEQ) { branch(flagZ); }
+    else if constexpr (info.op == Op::BNE) { branch(!flagZ); }
+    else if constexpr (info.op == Op::BMI) { branch(flagN); }
+    else if constexpr (info.op == Op::BPL) { branch(!flagN); }
+    else if constexpr (info.op == Op::BVC) { branch(!flagV); }
+    else if constexpr (info.op == Op::BVS) { branch(flagV); }
+    else if constexpr (info.op == Op::JMP) {
+        if constexpr (info.mode == AddrMode::IND) {
+            // 6502 page boundary bug
+            uint16_t lo = read(addr);
+            uint16_t hi;
+            if ((addr & 0xFF) == 0xFF)
+                hi = read(addr & 0xFF00);
+            else
+                hi = read(addr + 1);
+            pc = (hi << 8) | lo;
+        } else {
+            pc = addr;
         }
+    }
+    else if constexpr (info.op == Op::JSR) {
+        push16(pc - 1);
+        pc = addr;
+    }
+    else if constexpr (info.op == Op::RTS) { pc = pull16() + 1; }
+    else if constexpr (info.op == Op::RTI) {
+        setStatus(pull());
+        flagB = false;
+        pc = pull16();
+    }
+    else if constexpr (info.op == Op::BRK) {
+        pc++;
+        push16(pc);
+        push(getStatus() | 0x30);
+        flagI = true;
+        pc = read(0xFFFE) | ((uint16_t)read(0xFFFF) << 8);
+    }
+    else if constexpr (info.op == Op::TAX) { x = a; setZN(x); }
+    else if constexpr (info.op == Op::TXA) { a = x; setZN(a); }
+    else if constexpr (info.op == Op::TAY) { y = a; setZN(y); }
+    else if constexpr (info.op == Op::TYA) { a = y; setZN(a); }
+    else if constexpr (info.op == Op::TXS) { sp = x; }
+    else if constexpr (info.op == Op::TSX) { x = sp; setZN(x); }
+    else if constexpr (info.op == Op::PHA) { push(a); }
+    else if constexpr (info.op == Op::PLA) { a = pull(); setZN(a); }
+    else if constexpr (info.op == Op::PHP) { push(getStatus() | 0x10); }
+    else if constexpr (info.op == Op::PLP) { setStatus(pull()); flagB = false; }
+    else if constexpr (info.op == Op::CLC) { flagC = false; }
+    else if constexpr (info.op == Op::SEC) { flagC = true; }
+    else if constexpr (info.op == Op::CLD) { flagD = false; }
+    else if constexpr (info.op == Op::SED) { flagD = true; }
+    else if constexpr (info.op == Op::CLI) { flagI = false; }
+    else if constexpr (info.op == Op::SEI) { flagI = true; }
+    else if constexpr (info.op == Op::CLV) { flagV = false; }
+    else if constexpr (info.op == Op::NOP) { }
+    else if constexpr (info.op == Op::DOP) { pc++; }
+    else if constexpr (info.op == Op::TOP) { pc += 2; }
+    else if constexpr (info.op == Op::LAX) { a = x = load(); setZN(a); }
+    else if constexpr (info.op == Op::SAX) { write(addr, a & x); }
+    else if constexpr (info.op == Op::DCP) {
+        uint8_t m = read(addr) - 1;
+        write(addr, m);
+        flagC = a >= m;
+        setZN(a - m);
+    }
+    else if constexpr (info.op == Op::ISB) {
+        uint8_t m = read(addr) + 1;
+        write(addr, m);
+        adc(m ^ 0xFF);
+    }
+    else if constexpr (info.op == Op::SLO) { a |= modify(asl); setZN(a); }
+    else if constexpr (info.op == Op::RLA) { a &= modify(rol); setZN(a); }
+    else if constexpr (info.op == Op::SRE) { a ^= modify(lsr); setZN(a); }
+    else if constexpr (info.op == Op::RRA) { adc(modify(ror)); }
+}
 
-        // ===== DEC =====
-        case 0xC6: { addr = zp();  cycles = 5; goto do_dec; }
-        case 0xD6: { addr = zpx(); cycles = 6; goto do_dec; }
-        case 0xCE: { addr = abs_(); cycles = 6; goto do_dec; }
-        case 0xDE: { addr = abx(false); cycles = 7;
-            do_dec: {
-                uint8_t m = read(addr) - 1;
-                write(addr, m);
-                setZN(m);
-                break;
-            }
-        }
+// ===================== Block Cache =====================
+
+constexpr size_t MAX_BLOCK = 64;
+constexpr int JIT_THRESHOLD = 8; // runs through the interpreter before translating
+
+bool CPU::decodeBlock(uint16_t addr, Block& block) {
+    using Handler = void (*)(CPU&, uint16_t);
+    static constexpr auto handlers = []<size_t... I>(std::index_sequence<I...>) {
+        return std::array<Handler, 256>{
+            [](CPU& cpu, uint16_t operand) { cpu.execOp<I, true>(operand); }...};
+    }(std::make_index_sequence<256>{});
+
+    // Blocks live in memory pages only and span at most two of them
+    uint8_t firstPage = addr >> 8;
+    uint8_t lastPage = firstPage;
+    auto byteAt = [&](uint16_t at) -> int {
+        uint8_t page = at >> 8;
+        if (page != firstPage && (firstPage == 0xFF || page != firstPage + 1)) return -1;
+        const uint8_t* mem = bus->readPage(page);
+        if (!mem) return -1;
+        lastPage = std::max(lastPage, page);
+        return mem[at & 0xFF];
+    };
 
-        // ===== INX, INY, DEX, DEY =====
-        case 0xE8: x++; setZN(x); cycles = 2; break;  // INX
-        case 0xC8: y++; setZN(y); cycles = 2; break;  // INY
-        case 0xCA: x--; setZN(x); cycles = 2; break;  // DEX
-        case 0x88: y--; setZN(y); cycles = 2; break;  // DEY
+    block.code.clear();
+    block.maxCycles = 0;
+    block.runs = 0;
+    block.native = nullptr;
+    block.nativeCount = 0;
+    uint16_t at = addr;
+    while (block.code.size() < MAX_BLOCK) {
+        int opcode = byteAt(at);
+        if (opcode < 0) break;
+        const OpInfo& info = opTable[opcode];
+
+        int bytes = operandBytes(info.mode);
+        int lo = bytes > 0 ? byteAt(at + 1) : 0;
+        int hi = bytes > 1 ? byteAt(at + 2) : 0;
+        if (lo < 0 || hi < 0) break;
+
+        block.code.push_back({handlers[opcode], (uint16_t)(lo | (hi << 8)), (uint8_t)(1 + bytes),
+                              (uint8_t)opcode});
+        block.maxCycles += info.cycles + (info.pagePenalty ? 1 : 0) + (info.mode == Mode::REL ? 2 : 0);
+        if (endsBlock(info.op)) break;
+
+        at += 1 + bytes + (info.op == Op::DOP ? 1 : info.op == Op::TOP ? 2 : 0);
+    }
+    if (block.code.empty()) return false;
+
+    // Writes to the block's pages must now bump their versions
+    bus->watchPage(firstPage);
+    bus->watchPage(lastPage);
+    block.firstPage = firstPage;
+    block.lastPage = lastPage;
+    block.firstVersion = bus->pageVersion(firstPage);
+    block.lastVersion = bus->pageVersion(lastPage);
+    block.checkedEpoch = bus->versionEpoch();
+    return true;
+}
 
-        // ===== ASL =====
-        case 0x0A: // ASL A
-            flagC = (a & 0x80) != 0;
-            a <<= 1;
-            setZN(a);
-            cycles = 2;
-            break;
-        case 0x06: { addr = zp();  cycles = 5; goto do_asl; }
-        case 0x16: { addr = zpx(); cycles = 6; goto do_asl; }
-        case 0x0E: { addr = abs_(); cycles = 6; goto do_asl; }
-        case 0x1E: { addr = abx(false); cycles = 7;
-            do_asl: {
-                uint8_t m = read(addr);
-                flagC = (m & 0x80) != 0;
-                m <<= 1;
-                write(addr, m);
-                setZN(m);
-                break;
-            }
-        }
+CPU::Block* CPU::findBlock(uint16_t addr) {
+    if (!bus) return nullptr;
+    if (blockAt.empty()) blockAt.assign(0x10000, -1);
+
+    int32_t index = blockAt[addr];
+    if (index >= 0) {
+        Block& block = blocks[index];
+        if (block.checkedEpoch == bus->versionEpoch()) return &block;
+        if (bus->pageVersion(block.firstPage) == block.firstVersion &&
+            bus->pageVersion(block.lastPage) == block.lastVersion) {
+            block.checkedEpoch = bus->versionEpoch();
+            return &block;
+        }
+        // The code may have changed underneath: decode again in place
+        return decodeBlock(addr, block) ? &block : nullptr;
+    }
 
-        // ===== LSR =====
-        case 0x4A: // LSR A
-            flagC = (a & 0x01) != 0;
-            a >>= 1;
-            setZN(a);
-            cycles = 2;
-            break;
-        case 0x46: { addr = zp();  cycles = 5; goto do_lsr; }
-        case 0x56: { addr = zpx(); cycles = 6; goto do_lsr; }
-        case 0x4E: { addr = abs_(); cycles = 6; goto do_lsr; }
-        case 0x5E: { addr = abx(false); cycles = 7;
-            do_lsr: {
-                uint8_t m = read(addr);
-                flagC = (m & 0x01) != 0;
-                m >>= 1;
-                write(addr, m);
-                setZN(m);
-                break;
-            }
-        }
+    Block block;
+    if (!decodeBlock(addr, block)) return nullptr;
+    blockAt[addr] = (int32_t)blocks.size();
+    blocks.push_back(std::move(block));
+    return &blocks.back();
+}
 
-        // ===== ROL =====
-        case 0x2A: { // ROL A
-            bool oldC = flagC;
-            flagC = (a & 0x80) != 0;
-            a = (a << 1) | (oldC ? 1 : 0);
-            setZN(a);
-            cycles = 2;
-            break;
-        }
-        case 0x26: { addr = zp();  cycles = 5; goto do_rol; }
-        case 0x36: { addr = zpx(); cycles = 6; goto do_rol; }
-        case 0x2E: { addr = abs_(); cycles = 6; goto do_rol; }
-        case 0x3E: { addr = abx(false); cycles = 7;
-            do_rol: {
-                uint8_t m = read(addr);
-                bool oldC = flagC;
-                flagC = (m & 0x80) != 0;
-                m = (m << 1) | (oldC ? 1 : 0);
-                write(addr, m);
-                setZN(m);
-                break;
-            }
-        }
+void CPU::runBlock(uint64_t& time, uint64_t limit, const bool& stop) {
+    Block* block = findBlock(pc);
+    if (!block) {
+        clock(); // nothing pending, so this runs one instruction
+        return;
+    }
 
-        // ===== ROR =====
-        case 0x6A: { // ROR A
-            bool oldC = flagC;
-            flagC = (a & 0x01) != 0;
-            a = (a >> 1) | (oldC ? 0x80 : 0);
-            setZN(a);
-            cycles = 2;
-            break;
-        }
-        case 0x66: { addr = zp();  cycles = 5; goto do_ror; }
-        case 0x76: { addr = zpx(); cycles = 6; goto do_ror; }
-        case 0x6E: { addr = abs_(); cycles = 6; goto do_ror; }
-        case 0x7E: { addr = abx(false); cycles = 7;
-            do_ror: {
-                uint8_t m = read(addr);
-                bool oldC = flagC;
-                flagC = (m & 0x01) != 0;
-                m = (m >> 1) | (oldC ? 0x80 : 0);
-                write(addr, m);
-                setZN(m);
-                break;
-            }
-        }
+    uint64_t next = time;
+    for (;;) {
+        const Decoded* start = block->code.data();
+        const Decoded* end = start + block->code.size();
+        const Decoded* d = start;
+
+        if (jit && !block->native && ++block->runs == JIT_THRESHOLD) translate(*block);
+        if (block->native) {
+            // Native code runs a prefix of the block and hands the rest back
+            int done = jitCheck ? checkNative(*block, next, limit) : runNative(*block, next, limit);
+            d += done;
+            if (done > 0) time = next - 3 * (uint64_t)cycles;
+        }
+
+        // Blocks that finish well before the limit skip the per-instruction check
+        bool fits = next + 3 * (uint64_t)block->maxCycles < limit;
+        while (d != end && !stop) {
+            if (d != start && !fits && next >= limit) break;
+            time = next;
+            pc += d->fetched;
+            d->handler(*this, d->operand);
+            next = time + 3 * (uint64_t)cycles;
+            ++d;
+        }
+
+        // Chain straight into the next block while nothing needs servicing
+        if (d != end || stop || next >= limit) break;
+        block = findBlock(pc);
+        if (!block) break;
+    }
+    cycles--; // as in clock(): the instruction's first cycle is this one
+}
 
-        // ===== Branches =====
-        case 0x90: { // BCC
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (!flagC) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0xB0: { // BCS
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (flagC) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0xF0: { // BEQ
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (flagZ) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0xD0: { // BNE
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (!flagZ) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0x30: { // BMI
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (flagN) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0x10: { // BPL
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (!flagN) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0x50: { // BVC
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (!flagV) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
-        case 0x70: { // BVS
-            int8_t off = (int8_t)read(pc++);
-            cycles = 2;
-            if (flagV) {
-                uint16_t newPC = pc + off;
-                cycles += pageCross(pc, newPC) ? 2 : 1;
-                pc = newPC;
-            }
-            break;
-        }
+// ===================== JIT =====================
 
-        // ===== JMP =====
-        case 0x4C: { // JMP absolute
-            pc = abs_();
-            cycles = 3;
-            break;
-        }
-        case 0x6C: { // JMP indirect
-            uint16_t ptr = abs_();
-            // 6502 page boundary bug
-            uint16_t lo = read(ptr);
-            uint16_t hi;
-            if ((ptr & 0xFF) == 0xFF)
-                hi = read(ptr & 0xFF00);
-            else
-                hi = read(ptr + 1);
-            pc = (hi << 8) | lo;
-            cycles = 5;
-            break;
-        }
+void CPU::setJit(bool on, bool differential) {
+    if (on && !jit && Jit::supported()) {
+        jit = std::make_unique<Jit>();
+    } else if (!on) {
+        jit.reset();
+    }
+    for (Block& block : blocks) {
+        block.runs = 0;
+        block.native = nullptr;
+        block.nativeCount = 0;
+    }
+    jitCheck = on && differential;
+    if (on) useBlocks = true;
+}
 
-        // ===== JSR =====
-        case 0x20: {
-            uint16_t target = abs_();
-            push16(pc - 1);
-            pc = target;
-            cycles = 6;
-            break;
+void CPU::translate(Block& block) {
+    if (jit->full()) {
+        // Start over rather than track what is still live
+        jit->reset();
+        for (Block& other : blocks) {
+            other.native = nullptr;
+            other.nativeCount = 0;
         }
-
-        // ===== RTS =====
-        case 0x60:
-            pc = pull16() + 1;
-            cycles = 6;
-            break;
-
-        // ===== RTI =====
-        case 0x40:
-            setStatus(pull());
-            flagB = false;
-            pc = pull16();
-            cycles = 6;
-            break;
-
-        // ===== Transfers =====
-        case 0xAA: x = a; setZN(x); cycles = 2; break;  // TAX
-        case 0x8A: a = x; setZN(a); cycles = 2; break;  // TXA
-        case 0xA8: y = a; setZN(y); cycles = 2; break;  // TAY
-        case 0x98: a = y; setZN(a); cycles = 2; break;  // TYA
-        case 0x9A: sp = x;          cycles = 2; break;  // TXS
-        case 0xBA: x = sp; setZN(x); cycles = 2; break; // TSX
-
-        // ===== Stack =====
-        case 0x48: push(a); cycles = 3; break;                       // PHA
-        case 0x68: a = pull(); setZN(a); cycles = 4; break;          // PLA
-        case 0x08: push(getStatus() | 0x10); cycles = 3; break;      // PHP
-        case 0x28: setStatus(pull()); flagB = false; cycles = 4; break; // PLP
-
-        // ===== Flags =====
-        case 0x18: flagC = false; cycles = 2; break; // CLC
-        case 0x38: flagC = true;  cycles = 2; break; // SEC
-        case 0xD8: flagD = false; cycles = 2; break; // CLD
-        case 0xF8: flagD = true;  cycles = 2; break; // SED
-        case 0x58: flagI = false; cycles = 2; break; // CLI
-        case 0x78: flagI = true;  cycles = 2; break; // SEI
-        case 0xB8: flagV = false; cycles = 2; break; // CLV
-
-        // ===== NOP =====
-        case 0xEA: cycles = 2; break;
-
-        // ===== BRK =====
-        case 0x00:
-            pc++;
-            push16(pc);
-            push(getStatus() | 0x30);
-            flagI = true;
-            pc = read(0xFFFE) | ((uint16_t)read(0xFFFF) << 8);
-            cycles = 7;
-            break;
-
-        // ===== Unofficial NOPs (common ones games use) =====
-        case 0x1A: case 0x3A: case 0x5A: case 0x7A: case 0xDA: case 0xFA:
-            cycles = 2; break; // NOP implied
-        case 0x04: case 0x44: case 0x64:
-            pc++; cycles = 3; break; // DOP zero page
-        case 0x14: case 0x34: case 0x54: case 0x74: case 0xD4: case 0xF4:
-            pc++; cycles = 4; break; // DOP zero page X
-        case 0x80: case 0x82: case 0x89: case 0xC2: case 0xE2:
-            pc++; cycles = 2; break; // DOP immediate
-        case 0x0C:
-            pc += 2; cycles = 4; break; // TOP absolute
-        case 0x1C: case 0x3C: case 0x5C: case 0x7C: case 0xDC: case 0xFC:
-            { abx(); cycles = 4; if (extraCycle) cycles++; break; } // TOP absolute X
-
-        // ===== LAX (unofficial but used by some games) =====
-        case 0xA7: { addr = zp();  cycles = 3; goto do_lax; }
-        case 0xB7: { addr = zpy(); cycles = 4; goto do_lax; }
-        case 0xAF: { addr = abs_(); cycles = 4; goto do_lax; }
-        case 0xBF: { addr = aby(); cycles = 4; goto do_lax; }
-        case 0xA3: { addr = izx(); cycles = 6; goto do_lax; }
-        case 0xB3: { addr = izy(); cycles = 5;
-            do_lax:
-                a = x = read(addr);
-                setZN(a);
-                if (extraCycle) cycles++;
-                break;
+    }
+    std::vector<Jit::Instr> code;
+    code.reserve(block.code.size());
+    for (const Decoded& d : block.code) code.push_back({d.opcode, d.operand});
+    block.native = jit->compile(pc, code, block.nativeCount);
+    if (jit->failed()) {
+        // Earlier code may share pages that are no longer executable
+        for (Block& other : blocks) {
+            other.native = nullptr;
+            other.nativeCount = 0;
         }
+    }
+}
 
-        // ===== SAX (unofficial) =====
-        case 0x87: { addr = zp();  cycles = 3; goto do_sax; }
-        case 0x97: { addr = zpy(); cycles = 4; goto do_sax; }
-        case 0x8F: { addr = abs_(); cycles = 4; goto do_sax; }
-        case 0x83: { addr = izx(); cycles = 6;
-            do_sax:
-                write(addr, a & x);
-                break;
-        }
+int CPU::runNative(const Block& block, uint64_t& next, uint64_t limit) {
+    Jit::Context ctx{a, x, y, sp, flagC, flagZ, flagN, flagV, pc, 0, 0, next, limit,
+                     bus->readTable(), bus->writeTable()};
+    block.native(&ctx);
+    a = ctx.a; x = ctx.x; y = ctx.y; sp = ctx.sp;
+    flagC = ctx.c; flagZ = ctx.z; flagN = ctx.n; flagV = ctx.v;
+    pc = ctx.pc;
+    if (ctx.executed > 0) cycles = ctx.cycles;
+    next = ctx.next;
+    return ctx.executed;
+}
 
-        // ===== DCP (unofficial) =====
-        case 0xC7: { addr = zp();  cycles = 5; goto do_dcp; }
-        case 0xD7: { addr = zpx(); cycles = 6; goto do_dcp; }
-        case 0xCF: { addr = abs_(); cycles = 6; goto do_dcp; }
-        case 0xDF: { addr = abx(false); cycles = 7; goto do_dcp; }
-        case 0xDB: { addr = aby(false); cycles = 7; goto do_dcp; }
-        case 0xC3: { addr = izx(); cycles = 8; goto do_dcp; }
-        case 0xD3: { addr = izy(false); cycles = 8;
-            do_dcp: {
-                uint8_t m = read(addr) - 1;
-                write(addr, m);
-                flagC = a >= m;
-                setZN(a - m);
-                break;
-            }
+int CPU::checkNative(const Block& block, uint64_t& next, uint64_t limit) {
+    // Native code can only write pages that are mapped for writing
+    std::vector<uint8_t> before, after;
+    auto snapshot = [&](std::vector<uint8_t>& out) {
+        out.clear();
+        uint8_t* const* pages = bus->writeTable();
+        for (int page = 0; page < 256; page++) {
+            if (pages[page]) out.insert(out.end(), pages[page], pages[page] + 256);
         }
-
-        // ===== ISB/ISC (unofficial) =====
-        case 0xE7: { addr = zp();  cycles = 5; goto do_isb; }
-        case 0xF7: { addr = zpx(); cycles = 6; goto do_isb; }
-        case 0xEF: { addr = abs_(); cycles = 6; goto do_isb; }
-        case 0xFF: { addr = abx(false); cycles = 7; goto do_isb; }
-        case 0xFB: { addr = aby(false); cycles = 7; goto do_isb; }
-        case 0xE3: { addr = izx(); cycles = 8; goto do_isb; }
-        case 0xF3: { addr = izy(false); cycles = 8;
-            do_isb: {
-                uint8_t m = read(addr) + 1;
-                write(addr, m);
-                m ^= 0xFF;
-                uint16_t sum = a + m + (flagC ? 1 : 0);
-                flagC = sum > 0xFF;
-                flagV = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
-                a = sum & 0xFF;
-                setZN(a);
-                break;
-            }
+    };
+    auto restore = [&](const std::vector<uint8_t>& in) {
+        uint8_t* const* pages = bus->writeTable();
+        size_t at = 0;
+        for (int page = 0; page < 256; page++) {
+            if (pages[page]) { std::memcpy(pages[page], &in[at], 256); at += 256; }
         }
+    };
 
-        // ===== SLO (unofficial) =====
-        case 0x07: { addr = zp();  cycles = 5; goto do_slo; }
-        case 0x17: { addr = zpx(); cycles = 6; goto do_slo; }
-        case 0x0F: { addr = abs_(); cycles = 6; goto do_slo; }
-        case 0x1F: { addr = abx(false); cycles = 7; goto do_slo; }
-        case 0x1B: { addr = aby(false); cycles = 7; goto do_slo; }
-        case 0x03: { addr = izx(); cycles = 8; goto do_slo; }
-        case 0x13: { addr = izy(false); cycles = 8;
-            do_slo: {
-                uint8_t m = read(addr);
-                flagC = (m & 0x80) != 0;
-                m <<= 1;
-                write(addr, m);
-                a |= m;
-                setZN(a);
-                break;
-            }
-        }
+    struct Regs {
+        uint8_t a, x, y, sp;
+        bool c, z, n, v;
+        uint16_t pc;
+        int cycles;
+        uint64_t next;
+        bool operator==(const Regs&) const = default;
+    };
+    auto regs = [&] { return Regs{a, x, y, sp, flagC, flagZ, flagN, flagV, pc, cycles, next}; };
+    auto load = [&](const Regs& r) {
+        a = r.a; x = r.x; y = r.y; sp = r.sp;
+        flagC = r.c; flagZ = r.z; flagN = r.n; flagV = r.v;
+        pc = r.pc; cycles = r.cycles; next = r.next;
+    };
 
-        // ===== RLA (unofficial) =====
-        case 0x27: { addr = zp();  cycles = 5; goto do_rla; }
-        case 0x37: { addr = zpx(); cycles = 6; goto do_rla; }
-        case 0x2F: { addr = abs_(); cycles = 6; goto do_rla; }
-        case 0x3F: { addr = abx(false); cycles = 7; goto do_rla; }
-        case 0x3B: { addr = aby(false); cycles = 7; goto do_rla; }
-        case 0x23: { addr = izx(); cycles = 8; goto do_rla; }
-        case 0x33: { addr = izy(false); cycles = 8;
-            do_rla: {
-                uint8_t m = read(addr);
-                bool oldC = flagC;
-                flagC = (m & 0x80) != 0;
-                m = (m << 1) | (oldC ? 1 : 0);
-                write(addr, m);
-                a &= m;
-                setZN(a);
-                break;
-            }
-        }
+    Regs start = regs();
+    snapshot(before);
+    int done = runNative(block, next, limit);
+    Regs native = regs();
+    snapshot(after);
+
+    // Replay the same instructions through the interpreter
+    restore(before);
+    load(start);
+    for (int i = 0; i < done; i++) {
+        const Decoded& d = block.code[i];
+        uint64_t time = next;
+        pc += d.fetched;
+        d.handler(*this, d.operand);
+        next = time + 3 * (uint64_t)cycles;
+    }
+    Regs interpreted = regs();
+    snapshot(before);
+
+    if (!(native == interpreted) || before != after) {
+        mismatches++;
+        std::cerr << "JIT mismatch in block at $" << std::hex << start.pc << " after " << std::dec
+                  << done << " instructions:" << std::hex
+                  << " a=" << +native.a << "/" << +interpreted.a
+                  << " x=" << +native.x << "/" << +interpreted.x
+                  << " y=" << +native.y << "/" << +interpreted.y
+                  << " p=" << native.c + 2 * native.z + 64 * native.v + 128 * native.n << "/"
+                  << interpreted.c + 2 * interpreted.z + 64 * interpreted.v + 128 * interpreted.n
+                  << " pc=" << native.pc << "/" << interpreted.pc << std::dec
+                  << " cycles=" << native.cycles << "/" << interpreted.cycles
+                  << (before != after ? " (memory differs)" : "") << "\n";
+    }
+    return done;
+}
 
-        // ===== SRE (unofficial) =====
-        case 0x47: { addr = zp();  cycles = 5; goto do_sre; }
-        case 0x57: { addr = zpx(); cycles = 6; goto do_sre; }
-        case 0x4F: { addr = abs_(); cycles = 6; goto do_sre; }
-        case 0x5F: { addr = abx(false); cycles = 7; goto do_sre; }
-        case 0x5B: { addr = aby(false); cycles = 7; goto do_sre; }
-        case 0x43: { addr = izx(); cycles = 8; goto do_sre; }
-        case 0x53: { addr = izy(false); cycles = 8;
-            do_sre: {
-                uint8_t m = read(addr);
-                flagC = (m & 0x01) != 0;
-                m >>= 1;
-                write(addr, m);
-                a ^= m;
-                setZN(a);
-                break;
-            }
-        }
+// ===================== Save States =====================
 
-        // ===== RRA (unofficial) =====
-        case 0x67: { addr = zp();  cycles = 5; goto do_rra; }
-        case 0x77: { addr = zpx(); cycles = 6; goto do_rra; }
-        case 0x6F: { addr = abs_(); cycles = 6; goto do_rra; }
-        case 0x7F: { addr = abx(false); cycles = 7; goto do_rra; }
-        case 0x7B: { addr = aby(false); cycles = 7; goto do_rra; }
-        case 0x63: { addr = izx(); cycles = 8; goto do_rra; }
-        case 0x73: { addr = izy(false); cycles = 8;
-            do_rra: {
-                uint8_t m = read(addr);
-                bool oldC = flagC;
-                flagC = (m & 0x01) != 0;
-                m = (m >> 1) | (oldC ? 0x80 : 0);
-                write(addr, m);
-                // ADC
-                uint16_t sum = a + m + (flagC ? 1 : 0);
-                flagC = sum > 0xFF;
-                flagV = (~(a ^ m) & (a ^ sum) & 0x80) != 0;
-                a = sum & 0xFF;
-                setZN(a);
-                break;
-            }
-        }
+void CPU::saveState(StateWriter& w) const {
+    w.pod(a); w.pod(x); w.pod(y); w.pod(sp); w.pod(pc);
+    w.pod(flagC); w.pod(flagZ); w.pod(flagI); w.pod(flagD);
+    w.pod(flagB); w.pod(flagV); w.pod(flagN);
+    w.pod(cycles);
+    w.pod(stallCycles);
+}
 
-        default:
-            // Unknown opcode - treat as NOP
-            cycles = 2;
-            break;
-    }
+void CPU::loadState(StateReader& r) {
+    r.pod(a); r.pod(x); r.pod(y); r.pod(sp); r.pod(pc);
+    r.pod(flagC); r.pod(flagZ); r.pod(flagI); r.pod(flagD);
+    r.pod(flagB); r.pod(flagV); r.pod(flagN);
+    r.pod(cycles);
+    r.pod(stallCycles);
+    // Decoded blocks are checked against the bus page versions, which the
+    // bus bumps after restoring memory
 }
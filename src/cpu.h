@@ -1,12 +1,18 @@
 #pragma once
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+#include "jit.h"
 
 class Bus;
+class StateWriter;
+class StateReader;
 
 class CPU {
 public:
     CPU();
+    ~CPU();
 
     void connectBus(Bus* bus) { this->bus = bus; }
     void reset();
@@ -14,9 +20,58 @@ public:
     void nmi();
     void irq();
 
+    // Run one whole instruction right away; returns the cycles it took
+    int step();
+
+    // Catch-up scheduling: cycles still to burn before the next instruction
+    int pendingCycles() const { return cycles; }
+    void skipCycles(int n) { cycles -= n; }
+
+    // Cached interpreter: straight-line blocks are decoded once and run back
+    // to back. Off by default.
+    void setBlockCache(bool on) { useBlocks = on; }
+    bool blockCacheEnabled() const { return useBlocks; }
+
+    // Run decoded instructions starting at dot `time` (3 dots per cycle),
+    // moving `time` to each instruction as it starts. Stops at the end of the
+    // block, once `stop` is raised, or before an instruction that would start
+    // at or after `limit`. The last instruction's cycles are left pending,
+    // as after clock().
+    void runBlock(uint64_t& time, uint64_t limit, const bool& stop);
+
+    // Translate hot blocks to native code (x86-64 Linux only; a no-op
+    // elsewhere). Turns the block cache on with it. In differential mode every
+    // native run is replayed through the interpreter and compared; mismatches
+    // are reported on stderr and the interpreter's result is kept.
+    void setJit(bool on, bool differential = false);
+    bool jitEnabled() const { return jit != nullptr; }
+    uint64_t jitMismatches() const { return mismatches; }
+
     // For DMA stalling
     int stallCycles = 0;
 
+    // The programmer-visible registers, for engines that keep them elsewhere
+    // (see lockstep.h). p is the status byte, B included.
+    struct Registers {
+        uint8_t a, x, y, sp, p;
+        uint16_t pc;
+    };
+    Registers registers() const { return { a, x, y, sp, getStatus(), pc }; }
+    void setRegisters(const Registers& r) {
+        a = r.a; x = r.x; y = r.y; sp = r.sp; pc = r.pc;
+        setStatus(r.p);
+    }
+
+    // Save states (layout in state.h)
+    void saveState(StateWriter& w) const;
+    void loadState(StateReader& r);
+
+    // Addressing modes (used by the opcode table)
+    enum class AddrMode {
+        IMP, ACC, IMM, ZP, ZPX, ZPY,
+        ABS, ABX, ABY, IND, IZX, IZY, REL
+    };
+
 private:
     Bus* bus = nullptr;
 
@@ -53,14 +108,42 @@ private:
     void setStatus(uint8_t val);
     void setZN(uint8_t val);
 
-    // Addressing modes (return address)
-    enum class AddrMode {
-        IMP, ACC, IMM, ZP, ZPX, ZPY,
-        ABS, ABX, ABY, IND, IZX, IZY, REL
+    // Execute one instruction: fetch the opcode and dispatch through a
+    // handler table generated from the opcode table in cpu.cpp
+    void execute();
+    template <uint8_t Opcode, bool Cached = false> void execOp(uint16_t operand = 0);
+
+    // Block cache
+    struct Decoded {
+        void (*handler)(CPU&, uint16_t);
+        uint16_t operand; // immediate value or resolved (base) address
+        uint8_t fetched;  // opcode + operand bytes the addressing mode reads
+        uint8_t opcode;
+    };
+    struct Block {
+        uint8_t firstPage = 0, lastPage = 0;
+        uint32_t firstVersion = 0, lastVersion = 0;
+        uint32_t checkedEpoch = 0; // bus epoch the versions were last checked at
+        int maxCycles = 0; // with every page-cross and branch penalty
+        std::vector<Decoded> code;
+        int runs = 0;                   // until it is hot enough to translate
+        Jit::Code native = nullptr;     // covers the first nativeCount instructions
+        size_t nativeCount = 0;
     };
+    bool useBlocks = false;
+    std::vector<Block> blocks;
+    std::vector<int32_t> blockAt; // start address -> index into blocks, -1 if none
 
-    // Execute one instruction
-    void execute();
+    Block* findBlock(uint16_t addr);
+    bool decodeBlock(uint16_t addr, Block& block);
+
+    // JIT
+    std::unique_ptr<Jit> jit;
+    bool jitCheck = false;
+    uint64_t mismatches = 0;
+    void translate(Block& block);
+    int runNative(const Block& block, uint64_t& next, uint64_t limit);
+    int checkNative(const Block& block, uint64_t& next, uint64_t limit);
 
     // Page cross check
     bool pageCross(uint16_t a, uint16_t b) { return (a & 0xFF00) != (b & 0xFF00); }
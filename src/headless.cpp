@@ -0,0 +1,212 @@
+#include "console.h"
+#include "runahead.h"
+#include "batch.h"
+#include "palette.h"
+#include "upscale.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// FNV-1a over ARGB pixels
+static uint64_t hashPixels(const std::vector<uint32_t>& pixels) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(pixels.data());
+    for (size_t i = 0; i < pixels.size() * sizeof(uint32_t); i++) {
+        h ^= bytes[i];
+        h *= 0x100000001B3ull;
+    }
+    return h;
+}
+
+// The framebuffer's hash, so runs can be compared across builds. Hashed as
+// ARGB so the value doesn't depend on how the PPU stores pixels.
+static uint64_t hashFrame(const Console& nes) {
+    std::vector<uint32_t> pixels(256 * 240);
+    expandFrame(nes.frameBuffer(), nes.lineEmphasis(), pixels.data());
+    return hashPixels(pixels);
+}
+
+// A lone white pixel diagonal to a black one, in each of the four directions,
+// must upscale to mirror images of each other. Returns how many output pixels
+// around the black one disagree with the top-left case, mirrored.
+static int upscaleMirrorMismatches(Upscaler& upscaler) {
+    const int s = upscaler.scale(), outWidth = 256 * s;
+    const int cx = 100, cy = 100, size = 3 * s;
+    const int dirs[4][2] = { { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 } };
+    std::vector<uint32_t> in(256 * 240);
+    std::vector<uint32_t> out[4];
+    for (int k = 0; k < 4; k++) {
+        std::fill(in.begin(), in.end(), 0xFF000000);
+        in[(cy + dirs[k][1]) * 256 + cx + dirs[k][0]] = 0xFFFFFFFF;
+        out[k].resize(in.size() * s * s);
+        upscaler.upscale(in.data(), out[k].data());
+    }
+
+    // The 3x3 source pixels around (cx, cy), mirrored about their centre
+    int mismatches = 0;
+    const size_t origin = (size_t)(cy - 1) * s * outWidth + (cx - 1) * s;
+    for (int k = 1; k < 4; k++) {
+        for (int i = 0; i < size; i++) {
+            for (int j = 0; j < size; j++) {
+                int mi = dirs[k][1] > 0 ? size - 1 - i : i;
+                int mj = dirs[k][0] > 0 ? size - 1 - j : j;
+                mismatches += out[0][origin + (size_t)i * outWidth + j] !=
+                              out[k][origin + (size_t)mi * outWidth + mj];
+            }
+        }
+    }
+    return mismatches;
+}
+
+// K copies of the ROM stepped together by a BatchRunner, timed at 1, 2, 4...
+// threads up to `maxThreads`
+static int runBatch(const char* romPath, long frames, int count, int maxThreads,
+                    bool cached, bool jit) {
+    std::cout << "batch:           " << count << " consoles x " << frames << " frames\n"
+              << "threads    frames/s   speedup\n";
+
+    std::vector<uint8_t> inputs(count, 0);
+    uint64_t hash = 0;
+    double base = 0.0;
+    for (int threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+        BatchRunner batch(threads);
+        for (int i = 0; i < count; i++) {
+            Console* nes = batch.add(romPath);
+            if (!nes) return 1;
+            nes->cpu.setBlockCache(cached);
+            nes->cpu.setJit(jit);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        batch.step(inputs, (int)frames);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        double fps = (double)frames * count / seconds;
+        if (threads == 1) base = fps;
+        std::cout << std::setw(7) << threads << std::fixed << std::setprecision(1)
+                  << std::setw(12) << fps << std::setprecision(2) << std::setw(10) << fps / base
+                  << "\n";
+        hash = hashFrame(batch.console(0));
+        if (threads == maxThreads) break;
+    }
+
+    std::cout << "framebuffer:     0x" << std::hex << std::setw(16) << std::setfill('0') << hash
+              << std::dec << "\n";
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* romPath = nullptr;
+    long frames = 600;
+    bool cached = false;
+    bool jit = false;
+    bool jitCheck = false;
+    int runAhead = 0;
+    int batch = 0;
+    int threads = (int)std::thread::hardware_concurrency();
+    std::string upscale;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = std::strtol(argv[++i], nullptr, 10);
+        } else if (arg == "--cached") {
+            cached = true;
+        } else if (arg == "--jit") {
+            jit = true;
+        } else if (arg == "--run-ahead" && i + 1 < argc) {
+            runAhead = std::atoi(argv[++i]);
+        } else if (arg == "--batch" && i + 1 < argc) {
+            batch = std::atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "--upscale" && i + 1 < argc) {
+            upscale = argv[++i];
+        } else if (arg == "--jit-check") {
+            jit = jitCheck = true;
+        } else if (!romPath && arg[0] != '-') {
+            romPath = argv[i];
+        } else {
+            romPath = nullptr;
+            break;
+        }
+    }
+
+    Upscaler::Filter filter{};
+    bool upscaling = !upscale.empty();
+    if (!romPath || frames <= 0 || runAhead < 0 || batch < 0 || (batch && (runAhead || jitCheck)) ||
+        (upscaling && (batch || !Upscaler::parse(upscale, filter)))) {
+        std::cerr << "Usage: ./nes_headless <rom.nes> [--frames N] [--cached] [--jit | --jit-check]\n"
+                     "                     [--run-ahead N | --batch K [--threads T]]\n"
+                     "                     [--upscale hq2x|hq3x|xbrz2|xbrz3|xbrz4 [--threads T]]\n";
+        return 1;
+    }
+    if (batch > 0) {
+        return runBatch(romPath, frames, batch, threads < 1 ? 1 : threads, cached, jit);
+    }
+
+    Console nes;
+    nes.cpu.setBlockCache(cached);
+    nes.cpu.setJit(jit, jitCheck);
+    if (!nes.load(romPath)) {
+        return 1;
+    }
+
+    RunAhead ahead(nes);
+    ahead.setFrames(runAhead);
+
+    // Upscaling every frame as the frontend would, timed on its own
+    std::unique_ptr<Upscaler> upscaler;
+    std::vector<uint32_t> argb, scaled;
+    if (upscaling) {
+        upscaler = std::make_unique<Upscaler>(filter, threads < 1 ? 1 : threads);
+        argb.resize(256 * 240);
+        scaled.resize(argb.size() * upscaler->scale() * upscaler->scale());
+    }
+    double upscaleSeconds = 0.0;
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+
+    for (long f = 0; f < frames; f++) {
+        ahead.runFrame();
+        if (upscaler) {
+            auto before = Clock::now();
+            expandFrame(nes.frameBuffer(), nes.lineEmphasis(), argb.data());
+            upscaler->upscale(argb.data(), scaled.data());
+            upscaleSeconds += std::chrono::duration<double>(Clock::now() - before).count();
+        }
+    }
+
+    auto end = Clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count() - upscaleSeconds;
+    double nsPerFrame = seconds * 1e9 / (double)frames;
+
+    std::cout << "frames:          " << frames << "\n"
+              << "emulated fps:    " << std::fixed << std::setprecision(1) << frames / seconds << "\n"
+              << "ns per frame:    " << std::setprecision(0) << nsPerFrame << "\n"
+              << "framebuffer:     0x" << std::hex << std::setw(16) << std::setfill('0')
+              << hashFrame(nes) << std::dec << "\n";
+    if (runAhead > 0) {
+        std::cout << "run-ahead cost:  " << std::setprecision(0)
+                  << ahead.secondsPerAheadFrame() * 1e9 << " ns per hidden frame\n";
+    }
+    if (upscaler) {
+        std::cout << "upscale:         " << upscale << " on " << (threads < 1 ? 1 : threads) << " threads, "
+                  << std::setprecision(3) << upscaleSeconds * 1e3 / (double)frames << " ms per frame\n"
+                  << "upscaled frame:  0x" << std::hex << std::setw(16) << hashPixels(scaled) << std::dec << "\n"
+                  << "mirror mismatch: " << upscaleMirrorMismatches(*upscaler) << "\n";
+    }
+    if (jitCheck) {
+        std::cout << "jit mismatches:  " << nes.cpu.jitMismatches() << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,589 @@
+#include "jit.h"
+#include "opcodes.h"
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define NES_JIT 1
+#endif
+
+using namespace opcodes;
+
+#ifdef NES_JIT
+
+namespace {
+
+// ===================== x86-64 Encoding =====================
+
+enum Reg : int { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum Cond : int { CC_B = 2, CC_AE = 3, CC_E = 4, CC_NE = 5, CC_A = 7 };
+
+// Guest state in host registers. The generated code never calls out, so
+// only the callee-saved ones need preserving.
+constexpr Reg CTX = RDI;
+constexpr Reg PAGES = RBX;   // readPages table
+constexpr Reg TIME = RSI;    // dot the next instruction starts on
+constexpr Reg CYC = RBP;     // cycles of the last instruction
+constexpr Reg GA = R8, GX = R9, GY = R10, GSP = R11;
+constexpr Reg FC = R12, FZ = R13, FN = R14, FV = R15;
+// RAX, RCX, RDX are scratch: RAX = page pointer, RCX = value, RDX = address
+
+class Emitter {
+public:
+    std::vector<uint8_t> buf;
+
+    size_t size() const { return buf.size(); }
+    void byte(uint8_t b) { buf.push_back(b); }
+    void u16(uint16_t v) { byte(v & 0xFF); byte(v >> 8); }
+    void u32(uint32_t v) { for (int i = 0; i < 4; i++) byte((v >> (8 * i)) & 0xFF); }
+
+    // REX prefix; `byteReg` forces one so SPL/BPL/SIL/DIL are not read as AH..BH
+    void rex(bool w, int r, int x, int b, bool byteReg = false) {
+        uint8_t v = 0x40 | (w << 3) | ((r >> 3) << 2) | ((x >> 3) << 1) | (b >> 3);
+        if (v != 0x40 || byteReg) byte(v);
+    }
+    void modrmReg(int reg, int rm) { byte(0xC0 | ((reg & 7) << 3) | (rm & 7)); }
+    // [base + index*scale + disp32]; index < 0 for none
+    void modrmMem(int reg, int base, int index, int scale, int32_t disp) {
+        if (index < 0 && (base & 7) != RSP) {
+            byte(0x80 | ((reg & 7) << 3) | (base & 7));
+        } else {
+            int ss = scale == 8 ? 3 : scale == 4 ? 2 : scale == 2 ? 1 : 0;
+            byte(0x84 | ((reg & 7) << 3));
+            byte((ss << 6) | (((index < 0 ? RSP : index) & 7) << 3) | (base & 7));
+        }
+        u32((uint32_t)disp);
+    }
+
+    // op r/m32, r32 (0x01 add, 0x09 or, 0x21 and, 0x29 sub, 0x31 xor, 0x39 cmp,
+    // 0x85 test, 0x89 mov)
+    void rr(uint8_t opcode, Reg dst, Reg src, bool w = false) {
+        rex(w, src, 0, dst);
+        byte(opcode);
+        modrmReg(src, dst);
+    }
+    void mov(Reg dst, Reg src) { rr(0x89, dst, src); }
+    void add(Reg dst, Reg src) { rr(0x01, dst, src); }
+    void add64(Reg dst, Reg src) { rr(0x01, dst, src, true); }
+    void or_(Reg dst, Reg src) { rr(0x09, dst, src); }
+    void and_(Reg dst, Reg src) { rr(0x21, dst, src); }
+    void sub(Reg dst, Reg src) { rr(0x29, dst, src); }
+    void xor_(Reg dst, Reg src) { rr(0x31, dst, src); }
+    void cmp(Reg dst, Reg src) { rr(0x39, dst, src); }
+    void test(Reg dst, Reg src, bool w = false) { rr(0x85, dst, src, w); }
+
+    // Group 1 with imm32: /0 add, /1 or, /4 and, /5 sub, /6 xor, /7 cmp
+    void ri(int ext, Reg dst, int32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0x81);
+        modrmReg(ext, dst);
+        u32((uint32_t)imm);
+    }
+    void addi(Reg dst, int32_t imm) { ri(0, dst, imm); }
+    void andi(Reg dst, int32_t imm) { ri(4, dst, imm); }
+    void xori(Reg dst, int32_t imm) { ri(6, dst, imm); }
+    void cmpi(Reg dst, int32_t imm) { ri(7, dst, imm); }
+
+    void movi(Reg dst, uint32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        u32(imm);
+    }
+    // Group 2 shift by imm8: /4 shl, /5 shr
+    void shl(Reg dst, uint8_t n) { rex(false, 0, 0, dst); byte(0xC1); modrmReg(4, dst); byte(n); }
+    void shr(Reg dst, uint8_t n) { rex(false, 0, 0, dst); byte(0xC1); modrmReg(5, dst); byte(n); }
+    void inc(Reg dst) { rex(false, 0, 0, dst); byte(0xFF); modrmReg(0, dst); }
+    void dec(Reg dst) { rex(false, 0, 0, dst); byte(0xFF); modrmReg(1, dst); }
+    void not_(Reg dst) { rex(false, 0, 0, dst); byte(0xF7); modrmReg(2, dst); }
+
+    // movzx r32, r8 (the low byte of src)
+    void zx8(Reg dst, Reg src) {
+        rex(false, dst, 0, src, src >= RSP && src <= RDI);
+        byte(0x0F); byte(0xB6);
+        modrmReg(dst, src);
+    }
+    void setcc(Cond cc, Reg dst) {
+        rex(false, 0, 0, dst, dst >= RSP && dst <= RDI);
+        byte(0x0F); byte(0x90 + cc);
+        modrmReg(0, dst);
+    }
+
+    // Memory forms
+    void load8(Reg dst, Reg base, int index, int32_t disp) {   // movzx r32, byte [...]
+        rex(false, dst, index < 0 ? 0 : index, base);
+        byte(0x0F); byte(0xB6);
+        modrmMem(dst, base, index, 1, disp);
+    }
+    void store8(Reg src, Reg base, int index, int32_t disp) {  // mov byte [...], r8
+        rex(false, src, index < 0 ? 0 : index, base, src >= RSP && src <= RDI);
+        byte(0x88);
+        modrmMem(src, base, index, 1, disp);
+    }
+    void load64(Reg dst, Reg base, int index, int scale, int32_t disp) {
+        rex(true, dst, index < 0 ? 0 : index, base);
+        byte(0x8B);
+        modrmMem(dst, base, index, scale, disp);
+    }
+    void store64(Reg src, Reg base, int32_t disp) { rex(true, src, 0, base); byte(0x89); modrmMem(src, base, -1, 1, disp); }
+    void store32(Reg src, Reg base, int32_t disp) { rex(false, src, 0, base); byte(0x89); modrmMem(src, base, -1, 1, disp); }
+    void cmp64Mem(Reg reg, Reg base, int32_t disp) { rex(true, reg, 0, base); byte(0x3B); modrmMem(reg, base, -1, 1, disp); }
+    void storeImm32(Reg base, int32_t disp, uint32_t imm) { rex(false, 0, 0, base); byte(0xC7); modrmMem(0, base, -1, 1, disp); u32(imm); }
+    void storeImm16(Reg base, int32_t disp, uint16_t imm) { byte(0x66); rex(false, 0, 0, base); byte(0xC7); modrmMem(0, base, -1, 1, disp); u16(imm); }
+    // lea dst32, [src + src*2]
+    void times3(Reg dst, Reg src) {
+        rex(false, dst, src, src);
+        byte(0x8D);
+        byte(0x44 | ((dst & 7) << 3));
+        byte((1 << 6) | ((src & 7) << 3) | (src & 7));
+        byte(0);
+    }
+
+    void push(Reg r) { if (r >= R8) byte(0x41); byte(0x50 + (r & 7)); }
+    void pop(Reg r) { if (r >= R8) byte(0x41); byte(0x58 + (r & 7)); }
+    void ret() { byte(0xC3); }
+
+    // Forward jumps: returns the rel32 slot to patch
+    size_t jcc(Cond cc) { byte(0x0F); byte(0x80 + cc); u32(0); return size() - 4; }
+    size_t jmp() { byte(0xE9); u32(0); return size() - 4; }
+    void patch(size_t slot, size_t target) {
+        uint32_t rel = (uint32_t)(target - (slot + 4));
+        std::memcpy(&buf[slot], &rel, 4);
+    }
+};
+
+// ===================== Translation =====================
+
+#define CTX_OFF(field) (int32_t)offsetof(Jit::Context, field)
+
+bool translatable(const OpInfo& info) {
+    switch (info.op) {
+        case Op::LDA: case Op::LDX: case Op::LDY: case Op::STA: case Op::STX: case Op::STY:
+        case Op::ADC: case Op::SBC: case Op::AND: case Op::ORA: case Op::EOR:
+        case Op::CMP: case Op::CPX: case Op::CPY: case Op::BIT:
+        case Op::INC: case Op::DEC: case Op::ASL: case Op::LSR: case Op::ROL: case Op::ROR:
+        case Op::INX: case Op::INY: case Op::DEX: case Op::DEY:
+        case Op::TAX: case Op::TXA: case Op::TAY: case Op::TYA: case Op::TSX: case Op::TXS:
+        case Op::CLC: case Op::SEC: case Op::CLV:
+        case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BNE:
+        case Op::BMI: case Op::BPL: case Op::BVC: case Op::BVS:
+            return true;
+        case Op::NOP:
+            return info.mode == Mode::IMP;
+        case Op::JMP:
+            return info.mode == Mode::ABS;
+        default:
+            return false;
+    }
+}
+
+class Translator {
+public:
+    Emitter e;
+
+    // Jumps to the side exit placed before instruction `index`
+    struct Exit { size_t slot; int index; uint16_t pc; };
+    std::vector<Exit> exits;
+
+    void exitIf(Cond cc, int index, uint16_t pc) { exits.push_back({e.jcc(cc), index, pc}); }
+
+    void setZN(Reg r) {
+        e.test(r, r);
+        e.setcc(CC_E, FZ);
+        e.mov(FN, r);
+        e.shr(FN, 7);
+    }
+
+    // Effective address into RDX (bits 0-15); for the indexed modes bit 16
+    // carries the page-cross penalty
+    void address(const OpInfo& info, uint16_t operand) {
+        uint8_t zp = operand & 0xFF;
+        switch (info.mode) {
+            case Mode::ZP:
+            case Mode::ABS:
+                e.movi(RDX, operand);
+                break;
+            case Mode::ZPX:
+            case Mode::ZPY:
+                e.mov(RDX, info.mode == Mode::ZPX ? GX : GY);
+                e.addi(RDX, zp);
+                e.zx8(RDX, RDX);
+                break;
+            case Mode::ABX:
+            case Mode::ABY: {
+                Reg index = info.mode == Mode::ABX ? GX : GY;
+                e.mov(RCX, index);
+                e.addi(RCX, operand & 0xFF);
+                e.cmpi(RCX, 0xFF);
+                e.setcc(CC_A, RCX);
+                e.zx8(RCX, RCX);
+                e.shl(RCX, 16);
+                e.mov(RDX, index);
+                e.addi(RDX, operand);
+                e.andi(RDX, 0xFFFF);
+                e.or_(RDX, RCX);
+                break;
+            }
+            case Mode::IZX:
+                // Pointer pair in zero page, which is always RAM
+                e.load64(RAX, PAGES, -1, 1, 0);
+                e.mov(RCX, GX);
+                e.addi(RCX, zp);
+                e.zx8(RCX, RCX);
+                e.load8(RDX, RAX, RCX, 0);
+                e.inc(RCX);
+                e.zx8(RCX, RCX);
+                e.load8(RCX, RAX, RCX, 0);
+                e.shl(RCX, 8);
+                e.or_(RDX, RCX);
+                break;
+            case Mode::IZY:
+                e.load64(RAX, PAGES, -1, 1, 0);
+                e.load8(RDX, RAX, -1, (uint8_t)(zp + 1));
+                e.shl(RDX, 8);
+                e.load8(RCX, RAX, -1, zp);
+                e.add(RCX, GY);
+                e.add(RDX, RCX);
+                e.andi(RDX, 0xFFFF);
+                e.cmpi(RCX, 0xFF);
+                e.setcc(CC_A, RCX);
+                e.zx8(RCX, RCX);
+                e.shl(RCX, 16);
+                e.or_(RDX, RCX);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // RAX = page pointer for the address in RDX, or side exit if the page is
+    // not plain memory
+    void pagePointer(bool write, int index, uint16_t pc) {
+        e.mov(RAX, RDX);
+        e.shr(RAX, 8);
+        e.zx8(RAX, RAX);
+        if (write) {
+            e.load64(RCX, CTX, -1, 1, CTX_OFF(writePages));
+            e.load64(RAX, RCX, RAX, 8, 0);
+        } else {
+            e.load64(RAX, PAGES, RAX, 8, 0);
+        }
+        e.test(RAX, RAX, true);
+        exitIf(CC_E, index, pc);
+    }
+
+    // Past every possible exit: commit this instruction's cycle count
+    void cycles(const OpInfo& info) {
+        e.movi(CYC, info.cycles);
+        if (info.pagePenalty) {
+            e.mov(RCX, RDX);
+            e.shr(RCX, 16);
+            e.add(CYC, RCX);
+        }
+    }
+
+    void adc() { // A + RCX + C
+        e.mov(RAX, GA);
+        e.add(RAX, RCX);
+        e.add(RAX, FC);
+        e.mov(RDX, GA);
+        e.xor_(RDX, RCX);
+        e.not_(RDX);
+        e.mov(FV, GA);
+        e.xor_(FV, RAX);
+        e.and_(FV, RDX);
+        e.shr(FV, 7);
+        e.andi(FV, 1);
+        e.mov(FC, RAX);
+        e.shr(FC, 8);
+        e.zx8(GA, RAX);
+        setZN(GA);
+    }
+
+    void compare(Reg reg) { // reg - RCX
+        e.cmp(reg, RCX);
+        e.setcc(CC_AE, FC);
+        e.mov(RAX, reg);
+        e.sub(RAX, RCX);
+        e.zx8(RAX, RAX);
+        setZN(RAX);
+    }
+
+    // Shift/rotate the value in `r`
+    void shift(Op op, Reg r) {
+        switch (op) {
+            case Op::ASL:
+                e.mov(FC, r); e.shr(FC, 7);
+                e.shl(r, 1); e.zx8(r, r);
+                break;
+            case Op::LSR:
+                e.mov(FC, r); e.andi(FC, 1);
+                e.shr(r, 1);
+                break;
+            case Op::ROL:
+                e.mov(RDX, r); e.shr(RDX, 7);
+                e.shl(r, 1); e.or_(r, FC); e.zx8(r, r);
+                e.mov(FC, RDX);
+                break;
+            default: // ROR
+                e.mov(RDX, r); e.andi(RDX, 1);
+                e.shr(r, 1);
+                e.mov(RAX, FC); e.shl(RAX, 7); e.or_(r, RAX);
+                e.mov(FC, RDX);
+                break;
+        }
+    }
+
+    static Reg flagFor(Op op) {
+        switch (op) {
+            case Op::BCC: case Op::BCS: return FC;
+            case Op::BEQ: case Op::BNE: return FZ;
+            case Op::BMI: case Op::BPL: return FN;
+            default: return FV;
+        }
+    }
+
+    // Returns false if the instruction ends the block (pc already stored)
+    bool instruction(int index, uint16_t pc, const Jit::Instr& instr) {
+        const OpInfo& info = opTable[instr.opcode];
+        uint16_t next = pc + 1 + operandBytes(info.mode);
+
+        if (index > 0) {
+            e.cmp64Mem(TIME, CTX, CTX_OFF(limit));
+            exitIf(CC_AE, index, pc);
+        }
+
+        bool memory = info.mode != Mode::IMP && info.mode != Mode::ACC &&
+                      info.mode != Mode::IMM && info.mode != Mode::REL && info.op != Op::JMP;
+        bool stores = info.op == Op::STA || info.op == Op::STX || info.op == Op::STY;
+        bool rmw = (info.op == Op::INC || info.op == Op::DEC || info.op == Op::ASL ||
+                    info.op == Op::LSR || info.op == Op::ROL || info.op == Op::ROR) &&
+                   info.mode != Mode::ACC;
+
+        if (memory) {
+            address(info, instr.operand);
+            // RAM and PRG-RAM share one pointer for reads and writes, so a
+            // writable page is readable through it as well
+            pagePointer(stores || rmw, index, pc);
+        }
+        cycles(info);
+        if (memory) {
+            e.zx8(RDX, RDX);
+            if (!stores) e.load8(RCX, RAX, RDX, 0);
+        } else if (info.mode == Mode::IMM) {
+            e.movi(RCX, instr.operand & 0xFF);
+        }
+
+        switch (info.op) {
+            case Op::LDA: e.mov(GA, RCX); setZN(GA); break;
+            case Op::LDX: e.mov(GX, RCX); setZN(GX); break;
+            case Op::LDY: e.mov(GY, RCX); setZN(GY); break;
+            case Op::STA: e.store8(GA, RAX, RDX, 0); break;
+            case Op::STX: e.store8(GX, RAX, RDX, 0); break;
+            case Op::STY: e.store8(GY, RAX, RDX, 0); break;
+            case Op::AND: e.and_(GA, RCX); setZN(GA); break;
+            case Op::ORA: e.or_(GA, RCX); setZN(GA); break;
+            case Op::EOR: e.xor_(GA, RCX); setZN(GA); break;
+            case Op::ADC: adc(); break;
+            case Op::SBC: e.xori(RCX, 0xFF); adc(); break;
+            case Op::CMP: compare(GA); break;
+            case Op::CPX: compare(GX); break;
+            case Op::CPY: compare(GY); break;
+            case Op::BIT:
+                e.test(GA, RCX);
+                e.setcc(CC_E, FZ);
+                e.mov(FV, RCX); e.shr(FV, 6); e.andi(FV, 1);
+                e.mov(FN, RCX); e.shr(FN, 7);
+                break;
+            case Op::INC:
+            case Op::DEC:
+                if (info.op == Op::INC) e.inc(RCX); else e.dec(RCX);
+                e.zx8(RCX, RCX);
+                e.store8(RCX, RAX, RDX, 0);
+                setZN(RCX);
+                break;
+            case Op::ASL: case Op::LSR: case Op::ROL: case Op::ROR:
+                if (rmw) {
+                    // shift() may use RAX/RDX, so keep the location on the side
+                    e.push(RAX);
+                    e.push(RDX);
+                    shift(info.op, RCX);
+                    e.pop(RDX);
+                    e.pop(RAX);
+                    e.store8(RCX, RAX, RDX, 0);
+                    setZN(RCX);
+                } else {
+                    shift(info.op, GA);
+                    setZN(GA);
+                }
+                break;
+            case Op::INX: e.inc(GX); e.zx8(GX, GX); setZN(GX); break;
+            case Op::INY: e.inc(GY); e.zx8(GY, GY); setZN(GY); break;
+            case Op::DEX: e.dec(GX); e.zx8(GX, GX); setZN(GX); break;
+            case Op::DEY: e.dec(GY); e.zx8(GY, GY); setZN(GY); break;
+            case Op::TAX: e.mov(GX, GA); setZN(GX); break;
+            case Op::TXA: e.mov(GA, GX); setZN(GA); break;
+            case Op::TAY: e.mov(GY, GA); setZN(GY); break;
+            case Op::TYA: e.mov(GA, GY); setZN(GA); break;
+            case Op::TSX: e.mov(GX, GSP); setZN(GX); break;
+            case Op::TXS: e.mov(GSP, GX); break;
+            case Op::CLC: e.xor_(FC, FC); break;
+            case Op::SEC: e.movi(FC, 1); break;
+            case Op::CLV: e.xor_(FV, FV); break;
+            case Op::NOP: break;
+            case Op::JMP:
+                e.storeImm16(CTX, CTX_OFF(pc), instr.operand);
+                advanceTime();
+                return false;
+            default: { // branches
+                bool onSet = info.op == Op::BCS || info.op == Op::BEQ ||
+                             info.op == Op::BMI || info.op == Op::BVS;
+                uint16_t target = next + (int8_t)(instr.operand & 0xFF);
+                int takenCycles = ((next & 0xFF00) != (target & 0xFF00)) ? 4 : 3;
+                e.storeImm16(CTX, CTX_OFF(pc), next);
+                Reg flag = flagFor(info.op);
+                e.test(flag, flag);
+                size_t skip = e.jcc(onSet ? CC_E : CC_NE);
+                e.movi(CYC, takenCycles);
+                e.storeImm16(CTX, CTX_OFF(pc), target);
+                e.patch(skip, e.size());
+                advanceTime();
+                return false;
+            }
+        }
+        advanceTime();
+        return true;
+    }
+
+    void advanceTime() {
+        e.times3(RAX, CYC);
+        e.add64(TIME, RAX);
+    }
+
+    void prologue() {
+        for (Reg r : {RBX, RBP, R12, R13, R14, R15}) e.push(r);
+        e.load64(PAGES, CTX, -1, 1, CTX_OFF(readPages));
+        e.load8(GA, CTX, -1, CTX_OFF(a));
+        e.load8(GX, CTX, -1, CTX_OFF(x));
+        e.load8(GY, CTX, -1, CTX_OFF(y));
+        e.load8(GSP, CTX, -1, CTX_OFF(sp));
+        e.load8(FC, CTX, -1, CTX_OFF(c));
+        e.load8(FZ, CTX, -1, CTX_OFF(z));
+        e.load8(FN, CTX, -1, CTX_OFF(n));
+        e.load8(FV, CTX, -1, CTX_OFF(v));
+        e.load64(TIME, CTX, -1, 1, CTX_OFF(next));
+        e.xor_(CYC, CYC);
+    }
+
+    void epilogue() {
+        e.store8(GA, CTX, -1, CTX_OFF(a));
+        e.store8(GX, CTX, -1, CTX_OFF(x));
+        e.store8(GY, CTX, -1, CTX_OFF(y));
+        e.store8(GSP, CTX, -1, CTX_OFF(sp));
+        e.store8(FC, CTX, -1, CTX_OFF(c));
+        e.store8(FZ, CTX, -1, CTX_OFF(z));
+        e.store8(FN, CTX, -1, CTX_OFF(n));
+        e.store8(FV, CTX, -1, CTX_OFF(v));
+        e.store64(TIME, CTX, CTX_OFF(next));
+        e.store32(CYC, CTX, CTX_OFF(cycles));
+        for (Reg r : {R15, R14, R13, R12, RBP, RBX}) e.pop(r);
+        e.ret();
+    }
+};
+
+} // namespace
+
+Jit::Jit() {
+    // Never writable and executable at once: compile() opens the pages it
+    // writes and seals them again before handing the code out
+    void* mem = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        arena = static_cast<uint8_t*>(mem);
+        capacity = ARENA_SIZE;
+    }
+}
+
+Jit::~Jit() {
+    if (arena) munmap(arena, capacity);
+}
+
+bool Jit::protect(size_t begin, size_t end, int prot) {
+    static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    begin &= ~(page - 1);
+    end = (end + page - 1) & ~(page - 1);
+    if (mprotect(arena + begin, end - begin, prot) == 0) return true;
+
+    // Blocks may still point into the arena, so it is not unmapped here:
+    // the CPU drops them and everything stays interpreted
+    dead = true;
+    return false;
+}
+
+bool Jit::supported() {
+    return true;
+}
+
+Jit::Code Jit::compile(uint16_t addr, const std::vector<Instr>& code, size_t& count) {
+    count = 0;
+    if (!arena || dead || full()) return nullptr;
+
+    Translator t;
+    t.prologue();
+
+    uint16_t pc = addr;
+    bool open = true;
+    while (count < code.size() && open) {
+        const OpInfo& info = opTable[code[count].opcode];
+        if (!translatable(info)) break;
+        open = t.instruction((int)count, pc, code[count]);
+        pc += 1 + operandBytes(info.mode);
+        count++;
+    }
+    if (count == 0) return nullptr;
+
+    // Ran off the end of the translated prefix
+    if (open) t.e.storeImm16(CTX, CTX_OFF(pc), pc);
+    t.e.storeImm32(CTX, CTX_OFF(executed), (uint32_t)count);
+    size_t epilogue = t.e.size();
+    t.epilogue();
+
+    // Side exits: the instruction at `pc` has not run
+    for (const Translator::Exit& x : t.exits) {
+        t.e.patch(x.slot, t.e.size());
+        t.e.storeImm16(CTX, CTX_OFF(pc), x.pc);
+        t.e.storeImm32(CTX, CTX_OFF(executed), (uint32_t)x.index);
+        t.e.patch(t.e.jmp(), epilogue);
+    }
+
+    const std::vector<uint8_t>& bytes = t.e.buf;
+    if (bytes.size() > MAX_BLOCK_BYTES) {
+        count = 0;
+        return nullptr;
+    }
+    size_t begin = used, end = used + bytes.size();
+    if (!protect(begin, end, PROT_READ | PROT_WRITE)) {
+        count = 0;
+        return nullptr;
+    }
+    uint8_t* dst = arena + used;
+    std::memcpy(dst, bytes.data(), bytes.size());
+    if (!protect(begin, end, PROT_READ | PROT_EXEC)) {
+        count = 0;
+        return nullptr;
+    }
+    used += (bytes.size() + 15) & ~size_t(15);
+    return reinterpret_cast<Code>(dst);
+}
+
+#else
+
+Jit::Jit() {}
+Jit::~Jit() {}
+bool Jit::supported() { return false; }
+Jit::Code Jit::compile(uint16_t, const std::vector<Instr>&, size_t& count) {
+    count = 0;
+    return nullptr;
+}
+
+#endif
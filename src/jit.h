@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// x86-64 translator for CPU blocks. Generated code keeps the guest registers
+// and flags in host registers, touches memory only through the bus page
+// tables, and exits just before any instruction that would hit an I/O page
+// or start at/after the dot limit, so the interpreter can take over there.
+// Only built for x86-64 Linux; elsewhere compile() always returns nullptr.
+class Jit {
+public:
+    // Guest state loaded and stored by the generated code
+    struct Context {
+        uint8_t a, x, y, sp;
+        uint8_t c, z, n, v;      // flags as 0/1
+        uint16_t pc;             // out: next instruction
+        int32_t cycles;          // out: cycles of the last instruction run
+        int32_t executed;        // out: instructions run
+        uint64_t next;           // in/out: dot the next instruction starts on
+        uint64_t limit;          // no instruction starts at or after this dot
+        const uint8_t* const* readPages;
+        uint8_t* const* writePages;
+    };
+    using Code = void (*)(Context*);
+
+    // One decoded instruction of the block to translate
+    struct Instr {
+        uint8_t opcode;
+        uint16_t operand;
+    };
+
+    Jit();
+    ~Jit();
+    Jit(const Jit&) = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static bool supported();
+
+    // Translate the longest supported prefix of a block starting at `addr`.
+    // `count` receives the number of instructions covered. Returns nullptr if
+    // not even the first instruction can be translated or the arena is full.
+    Code compile(uint16_t addr, const std::vector<Instr>& code, size_t& count);
+
+    bool full() const { return used + MAX_BLOCK_BYTES > capacity; }
+    void reset() { used = 0; } // invalidates every Code handed out so far
+
+    // The arena's protection could not be changed: code handed out earlier
+    // may no longer be executable, so none of it may run again, and
+    // compile() returns nullptr from then on
+    bool failed() const { return dead; }
+
+private:
+    static constexpr size_t ARENA_SIZE = 4 << 20;
+    static constexpr size_t MAX_BLOCK_BYTES = 16 << 10;
+
+    uint8_t* arena = nullptr; // read+execute, except while compile() writes to it
+    size_t capacity = 0;
+    size_t used = 0;
+    bool dead = false;
+
+    // mprotect the pages spanning [begin, end) of the arena; on failure the
+    // JIT is marked failed(). The arena stays mapped until destruction.
+    bool protect(size_t begin, size_t end, int prot);
+};
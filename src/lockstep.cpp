@@ -0,0 +1,410 @@
+#include "lockstep.h"
+#include "bus.h"
+#include "cartridge.h"
+#include "controller.h"
+#include "opcodes.h"
+#include <algorithm>
+#include <limits>
+
+using namespace opcodes;
+
+struct LockstepCpu::Lane {
+    Cartridge cartridge;
+    Bus bus;
+    CPU cpu;
+    Controller ctrl1, ctrl2;
+
+    Lane() {
+        bus.connectCartridge(&cartridge);
+        bus.connectController(&ctrl1, &ctrl2);
+        cpu.connectBus(&bus);
+    }
+};
+
+LockstepCpu::LockstepCpu(int lanes) : count(lanes < 1 ? 1 : lanes) {
+    for (int l = 0; l < count; l++) {
+        lane.push_back(std::make_unique<Lane>());
+        readTable.push_back(lane[l]->bus.readTable());
+        writeTable.push_back(lane[l]->bus.writeTable());
+    }
+    for (auto* reg : { &a, &x, &y, &sp, &p, &mask, &value, &extra }) {
+        reg->assign(count, 0);
+    }
+    pc.assign(count, 0);
+    addr.assign(count, 0);
+    cycles.assign(count, 0);
+    left.assign(count, 0);
+}
+
+LockstepCpu::~LockstepCpu() = default;
+
+bool LockstepCpu::load(const std::vector<uint8_t>& image) {
+    for (int l = 0; l < count; l++) {
+        if (!lane[l]->cartridge.loadFromMemory(image)) return false;
+        lane[l]->cpu.reset();
+        storeRegisters(l, lane[l]->cpu.registers());
+        cycles[l] = 0;
+    }
+    laneSteps = laneInstrs = scalarInstrs = 0;
+    return true;
+}
+
+void LockstepCpu::setButtons(int l, uint8_t buttons) {
+    lane[l]->ctrl1.setButtonState(buttons);
+}
+
+CPU::Registers LockstepCpu::registers(int l) const {
+    return { a[l], x[l], y[l], sp[l], p[l], pc[l] };
+}
+
+void LockstepCpu::storeRegisters(int l, const CPU::Registers& r) {
+    a[l] = r.a; x[l] = r.x; y[l] = r.y; sp[l] = r.sp; p[l] = r.p; pc[l] = r.pc;
+}
+
+uint8_t LockstepCpu::peek(int l, uint16_t at) const {
+    const uint8_t* page = readTable[l][at >> 8];
+    return page ? page[at & 0xFF] : 0;
+}
+
+double LockstepCpu::laneUtilization() const {
+    return laneSteps ? (double)laneInstrs / ((double)laneSteps * count) : 0.0;
+}
+
+void LockstepCpu::run(uint64_t budget) {
+    // Budgets are tracked per lane as int32 countdowns
+    while (budget > 0) {
+        int32_t chunk = (int32_t)std::min<uint64_t>(budget, 1u << 30);
+        budget -= chunk;
+        for (int l = 0; l < count; l++) left[l] = chunk;
+        if (scalarOnly) runScalar();
+        else runLanes();
+        for (int l = 0; l < count; l++) cycles[l] += (uint64_t)(chunk - left[l]);
+    }
+}
+
+void LockstepCpu::runScalar() {
+    for (int l = 0; l < count; l++) {
+        CPU& cpu = lane[l]->cpu;
+        cpu.setRegisters(registers(l));
+        while (left[l] > 0) {
+            left[l] -= cpu.step();
+            scalarInstrs++;
+        }
+        storeRegisters(l, cpu.registers());
+    }
+}
+
+void LockstepCpu::runLanes() {
+    const int N = count;
+    const int32_t* budget = left.data();
+    const uint16_t* at = pc.data();
+    uint8_t* m = mask.data();
+    for (;;) {
+        // Leader: the lane with the most cycles still to run
+        int32_t most = 0;
+        for (int l = 0; l < N; l++) most = std::max(most, budget[l]);
+        if (most <= 0) return;
+        int leader = 0;
+        while (budget[leader] != most) leader++;
+
+        uint16_t where = at[leader];
+        for (int l = 0; l < N; l++) {
+            m[l] = (at[l] == where) & (budget[l] > 0) ? 0xFF : 0;
+        }
+        if (!stepLanes(where)) {
+            for (int l = 0; l < N; l++) {
+                if (m[l]) stepScalar(l);
+            }
+        }
+    }
+}
+
+void LockstepCpu::stepScalar(int l) {
+    CPU& cpu = lane[l]->cpu;
+    cpu.setRegisters(registers(l));
+    left[l] -= cpu.step();
+    storeRegisters(l, cpu.registers());
+    scalarInstrs++;
+}
+
+// ===================== Lane execution =====================
+
+// What the lane path implements; everything else goes to the scalar CPUs
+static bool laneOp(Op op) {
+    switch (op) {
+        case Op::RTI: case Op::BRK: case Op::PHP: case Op::PLP:
+        case Op::DOP: case Op::TOP: case Op::LAX: case Op::SAX:
+        case Op::DCP: case Op::ISB: case Op::SLO: case Op::RLA: case Op::SRE: case Op::RRA:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// yes on lanes whose mask byte is 0xFF, no elsewhere
+static inline uint8_t blend(uint8_t m, uint8_t yes, uint8_t no) {
+    return (uint8_t)((yes & m) | (no & ~m));
+}
+
+bool LockstepCpu::stepLanes(uint16_t at) {
+    // PRG-ROM is the same in every lane, so lane 0's copy decodes for all
+    if (at < 0x8000) return false;
+    const uint8_t* const* rom = readTable[0];
+    const OpInfo& info = opTable[rom[at >> 8] ? rom[at >> 8][at & 0xFF] : 0];
+    if (!laneOp(info.op) || (info.op == Op::JMP && info.mode == Mode::IND)) return false;
+
+    int len = 1 + operandBytes(info.mode);
+    if (at + len > 0x10000 || !rom[(at + len - 1) >> 8]) return false;
+    auto fetch = [=](uint16_t where) { return rom[where >> 8][where & 0xFF]; };
+    uint16_t operand = len > 1 ? fetch(at + 1) : 0;
+    if (len > 2) operand |= fetch(at + 2) << 8;
+    uint16_t next = at + len;
+
+    // Plain pointers for the loops below: stores through a vector's
+    // uint8_t elements could alias the vector itself, which stops the
+    // compiler from vectorizing
+    const int N = count;
+    uint8_t *A = a.data(), *X = x.data(), *Y = y.data(), *S = sp.data(), *P = p.data();
+    uint8_t *m = mask.data(), *val = value.data(), *ext = extra.data();
+    uint16_t *PC = pc.data(), *ea = addr.data();
+    const uint8_t* const* const* rd = readTable.data();
+    uint8_t* const* const* wr = writeTable.data();
+    std::fill(ext, ext + N, 0);
+
+    // Effective addresses. Zero page is RAM in every lane, so the indirect
+    // modes read their pointers straight from it.
+    switch (info.mode) {
+        case Mode::IMM:
+            std::fill(val, val + N, (uint8_t)operand);
+            break;
+        case Mode::ZP: case Mode::ABS:
+            std::fill(ea, ea + N, operand);
+            break;
+        case Mode::ZPX: case Mode::ZPY: {
+            const uint8_t* index = info.mode == Mode::ZPX ? X : Y;
+            for (int l = 0; l < N; l++) ea[l] = (uint8_t)(operand + index[l]);
+            break;
+        }
+        case Mode::ABX: case Mode::ABY: {
+            const uint8_t* index = info.mode == Mode::ABX ? X : Y;
+            uint8_t lo = operand & 0xFF;
+            for (int l = 0; l < N; l++) {
+                ea[l] = operand + index[l];
+                ext[l] = info.pagePenalty && lo + index[l] > 0xFF;
+            }
+            break;
+        }
+        case Mode::IZX:
+            for (int l = 0; l < N; l++) {
+                const uint8_t* zp = rd[l][0];
+                uint8_t ptr = operand + X[l];
+                ea[l] = zp[ptr] | (zp[(uint8_t)(ptr + 1)] << 8);
+            }
+            break;
+        case Mode::IZY:
+            for (int l = 0; l < N; l++) {
+                const uint8_t* zp = rd[l][0];
+                uint8_t lo = zp[operand & 0xFF];
+                ea[l] = (lo | (zp[(operand + 1) & 0xFF] << 8)) + Y[l];
+                ext[l] = info.pagePenalty && lo + Y[l] > 0xFF;
+            }
+            break;
+        default:
+            break;
+    }
+
+    bool memory = info.mode != Mode::IMP && info.mode != Mode::ACC && info.mode != Mode::IMM &&
+                  info.mode != Mode::REL && info.op != Op::JMP && info.op != Op::JSR;
+    bool store = info.op == Op::STA || info.op == Op::STX || info.op == Op::STY;
+    bool rmw = memory && (info.op == Op::INC || info.op == Op::DEC || info.op == Op::ASL ||
+                          info.op == Op::LSR || info.op == Op::ROL || info.op == Op::ROR);
+
+    // Lanes whose access leaves plain memory take the scalar path instead
+    deferred.clear();
+    if (memory) {
+        for (int l = 0; l < N; l++) {
+            if (!m[l]) continue;
+            uint8_t page = ea[l] >> 8;
+            const uint8_t* from = rd[l][page];
+            if ((!store && !from) || ((store || rmw) && !wr[l][page])) {
+                m[l] = 0;
+                deferred.push_back(l);
+            } else if (!store) {
+                val[l] = from[ea[l] & 0xFF];
+            }
+        }
+    }
+    auto storeLanes = [=](const uint8_t* src) {
+        for (int l = 0; l < N; l++) {
+            if (m[l]) wr[l][ea[l] >> 8][ea[l] & 0xFF] = src[l];
+        }
+    };
+
+    // Register and flag updates, blended into the participating lanes
+    constexpr uint8_t FC = 0x01, FZ = 0x02, FI = 0x04, FD = 0x08, FV = 0x40, FN = 0x80;
+    auto zn = [](uint8_t r) { return (uint8_t)((r == 0 ? FZ : 0) | (r & FN)); };
+    auto load = [=](uint8_t* reg, auto fn) {
+        for (int l = 0; l < N; l++) {
+            uint8_t r = fn(l);
+            reg[l] = blend(m[l], r, reg[l]);
+            P[l] = blend(m[l], (P[l] & ~(FZ | FN)) | zn(r), P[l]);
+        }
+    };
+    auto compare = [=](const uint8_t* reg) {
+        for (int l = 0; l < N; l++) {
+            uint8_t flags = zn(reg[l] - val[l]) | (reg[l] >= val[l] ? FC : 0);
+            P[l] = blend(m[l], (P[l] & ~(FC | FZ | FN)) | flags, P[l]);
+        }
+    };
+    auto adc = [=](uint8_t invert) {
+        for (int l = 0; l < N; l++) {
+            uint8_t in = val[l] ^ invert;
+            uint16_t sum = A[l] + in + (P[l] & FC);
+            uint8_t r = (uint8_t)sum;
+            uint8_t flags = zn(r) | (sum >> 8) | ((~(A[l] ^ in) & (A[l] ^ r) & 0x80) >> 1);
+            P[l] = blend(m[l], (P[l] & ~(FC | FZ | FV | FN)) | flags, P[l]);
+            A[l] = blend(m[l], r, A[l]);
+        }
+    };
+    // Shifts and rotates on A or on memory; fn returns the result with the
+    // carry out in bit 8
+    auto shift = [=](auto fn) {
+        uint8_t* src = info.mode == Mode::ACC ? A : val;
+        for (int l = 0; l < N; l++) {
+            uint16_t r = fn(src[l], P[l] & FC);
+            P[l] = blend(m[l], (P[l] & ~(FC | FZ | FN)) | zn((uint8_t)r) | (r >> 8), P[l]);
+            src[l] = blend(m[l], (uint8_t)r, src[l]);
+        }
+        if (info.mode != Mode::ACC) storeLanes(val);
+    };
+    auto setFlag = [=](uint8_t flag, bool on) {
+        for (int l = 0; l < N; l++) P[l] = blend(m[l], on ? (P[l] | flag) : (P[l] & ~flag), P[l]);
+    };
+    auto branch = [=](uint8_t flag, bool set) {
+        uint16_t target = next + (int8_t)operand;
+        uint8_t penalty = (target >> 8) != (next >> 8) ? 2 : 1;
+        for (int l = 0; l < N; l++) {
+            uint8_t taken = m[l] & (((P[l] & flag) != 0) == set ? 0xFF : 0);
+            PC[l] = taken ? target : (m[l] ? next : PC[l]);
+            ext[l] = taken & penalty;
+        }
+    };
+    auto push = [=](int l, uint8_t data) {
+        wr[l][0x01][S[l]] = data;
+        S[l]--;
+    };
+    auto pull = [=](int l) -> uint8_t {
+        S[l]++;
+        return rd[l][0x01][S[l]];
+    };
+
+    switch (info.op) {
+        case Op::LDA: load(A, [=](int l) { return val[l]; }); break;
+        case Op::LDX: load(X, [=](int l) { return val[l]; }); break;
+        case Op::LDY: load(Y, [=](int l) { return val[l]; }); break;
+        case Op::AND: load(A, [=](int l) { return (uint8_t)(A[l] & val[l]); }); break;
+        case Op::ORA: load(A, [=](int l) { return (uint8_t)(A[l] | val[l]); }); break;
+        case Op::EOR: load(A, [=](int l) { return (uint8_t)(A[l] ^ val[l]); }); break;
+        case Op::ADC: adc(0x00); break;
+        case Op::SBC: adc(0xFF); break;
+        case Op::CMP: compare(A); break;
+        case Op::CPX: compare(X); break;
+        case Op::CPY: compare(Y); break;
+        case Op::BIT:
+            for (int l = 0; l < N; l++) {
+                uint8_t flags = ((A[l] & val[l]) == 0 ? FZ : 0) | (val[l] & (FV | FN));
+                P[l] = blend(m[l], (P[l] & ~(FZ | FV | FN)) | flags, P[l]);
+            }
+            break;
+        case Op::STA: storeLanes(A); break;
+        case Op::STX: storeLanes(X); break;
+        case Op::STY: storeLanes(Y); break;
+        case Op::INC: case Op::DEC: {
+            uint8_t delta = info.op == Op::INC ? 1 : 0xFF;
+            load(val, [=](int l) { return (uint8_t)(val[l] + delta); });
+            storeLanes(val);
+            break;
+        }
+        case Op::INX: load(X, [=](int l) { return (uint8_t)(X[l] + 1); }); break;
+        case Op::INY: load(Y, [=](int l) { return (uint8_t)(Y[l] + 1); }); break;
+        case Op::DEX: load(X, [=](int l) { return (uint8_t)(X[l] - 1); }); break;
+        case Op::DEY: load(Y, [=](int l) { return (uint8_t)(Y[l] - 1); }); break;
+        case Op::ASL: shift([](uint16_t in, uint16_t) { return (uint16_t)(in << 1); }); break;
+        case Op::LSR: shift([](uint16_t in, uint16_t) { return (uint16_t)((in >> 1) | ((in & 1) << 8)); }); break;
+        case Op::ROL: shift([](uint16_t in, uint16_t cin) { return (uint16_t)((in << 1) | cin); }); break;
+        case Op::ROR:
+            shift([](uint16_t in, uint16_t cin) {
+                return (uint16_t)((in >> 1) | (cin << 7) | ((in & 1) << 8));
+            });
+            break;
+        case Op::TAX: load(X, [=](int l) { return A[l]; }); break;
+        case Op::TAY: load(Y, [=](int l) { return A[l]; }); break;
+        case Op::TXA: load(A, [=](int l) { return X[l]; }); break;
+        case Op::TYA: load(A, [=](int l) { return Y[l]; }); break;
+        case Op::TSX: load(X, [=](int l) { return S[l]; }); break;
+        case Op::TXS:
+            for (int l = 0; l < N; l++) S[l] = blend(m[l], X[l], S[l]);
+            break;
+        case Op::CLC: setFlag(FC, false); break;
+        case Op::SEC: setFlag(FC, true); break;
+        case Op::CLV: setFlag(FV, false); break;
+        case Op::CLI: setFlag(FI, false); break;
+        case Op::SEI: setFlag(FI, true); break;
+        case Op::CLD: setFlag(FD, false); break;
+        case Op::SED: setFlag(FD, true); break;
+        case Op::PHA:
+            for (int l = 0; l < N; l++) {
+                if (m[l]) push(l, A[l]);
+            }
+            break;
+        case Op::PLA:
+            for (int l = 0; l < N; l++) {
+                if (m[l]) val[l] = pull(l);
+            }
+            load(A, [=](int l) { return val[l]; });
+            break;
+        case Op::BCC: branch(FC, false); break;
+        case Op::BCS: branch(FC, true); break;
+        case Op::BNE: branch(FZ, false); break;
+        case Op::BEQ: branch(FZ, true); break;
+        case Op::BPL: branch(FN, false); break;
+        case Op::BMI: branch(FN, true); break;
+        case Op::BVC: branch(FV, false); break;
+        case Op::BVS: branch(FV, true); break;
+        case Op::JMP:
+            for (int l = 0; l < N; l++) PC[l] = m[l] ? operand : PC[l];
+            break;
+        case Op::JSR:
+            for (int l = 0; l < N; l++) {
+                if (!m[l]) continue;
+                push(l, (uint8_t)((next - 1) >> 8));
+                push(l, (uint8_t)(next - 1));
+                PC[l] = operand;
+            }
+            break;
+        case Op::RTS:
+            for (int l = 0; l < N; l++) {
+                if (!m[l]) continue;
+                uint16_t lo = pull(l);
+                uint16_t hi = pull(l);
+                PC[l] = ((hi << 8) | lo) + 1;
+            }
+            break;
+        default: // NOP
+            break;
+    }
+
+    int32_t* budget = left.data();
+    bool jumps = endsBlock(info.op);
+    int active = 0;
+    for (int l = 0; l < N; l++) {
+        if (!jumps) PC[l] = m[l] ? next : PC[l];
+        budget[l] -= m[l] ? info.cycles + ext[l] : 0;
+        active += m[l] & 1;
+    }
+    laneSteps++;
+    laneInstrs += active;
+
+    for (int l : deferred) stepScalar(l);
+    return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "cpu.h"
+
+// Experimental: many copies of one ROM's CPU stepped in lock-step, for
+// batch workloads that run the same game hundreds of times. Registers and
+// flags are kept as struct-of-arrays lanes. Each step takes the lane that is
+// furthest behind and runs its instruction on every lane at the same PC: the
+// instruction is fetched and decoded once, then applied by branch-free loops
+// over the lane arrays that the compiler turns into vector code (AVX2/AVX-512
+// with NES_NATIVE). Lanes at other PCs wait their turn and usually rejoin at
+// the next loop head.
+//
+// Each lane also has its own Bus and scalar CPU. Instructions the lane path
+// doesn't cover, code outside PRG-ROM and accesses that miss the bus page
+// tables (I/O) run there, on that lane alone.
+//
+// CPU + RAM + PRG + controller only, like the cpu_* bench kernels: no PPU or
+// APU, so this measures instruction throughput, not frames.
+class LockstepCpu {
+public:
+    explicit LockstepCpu(int lanes);
+    ~LockstepCpu();
+
+    // Load the ROM (full iNES image) into every lane and reset them all
+    bool load(const std::vector<uint8_t>& image);
+
+    int lanes() const { return count; }
+
+    // Player 1's buttons on one lane (Controller::Button bits)
+    void setButtons(int lane, uint8_t buttons);
+
+    // Run every lane for at least `cycles` more CPU cycles. A lane stops at
+    // the same instruction boundary whichever path ran it.
+    void run(uint64_t cycles);
+
+    // Run every lane on its scalar CPU only, as a baseline
+    void setScalarOnly(bool on) { scalarOnly = on; }
+
+    CPU::Registers registers(int lane) const;
+    uint64_t laneCycles(int lane) const { return cycles[lane]; }
+    uint8_t peek(int lane, uint16_t addr) const; // RAM/PRG; 0 for I/O
+
+    // Since load(), summed over lanes
+    uint64_t instructions() const { return laneInstrs + scalarInstrs; }
+    uint64_t scalarInstructions() const { return scalarInstrs; }
+    // Average share of the lanes that took part in a lock-step instruction
+    double laneUtilization() const;
+
+private:
+    struct Lane;
+    int count;
+    std::vector<std::unique_ptr<Lane>> lane;
+    bool scalarOnly = false;
+
+    // Lane registers; p is the whole status byte, as PHP would push it
+    std::vector<uint8_t> a, x, y, sp, p;
+    std::vector<uint16_t> pc;
+    std::vector<uint64_t> cycles;
+    std::vector<int32_t> left; // cycles still to run in this run()
+    std::vector<const uint8_t* const*> readTable;
+    std::vector<uint8_t* const*> writeTable;
+
+    // Per-step scratch
+    std::vector<uint8_t> mask;   // 0xFF = lane takes part
+    std::vector<uint16_t> addr;  // effective address
+    std::vector<uint8_t> value;  // operand value
+    std::vector<uint8_t> extra;  // page-cross/branch cycles
+    std::vector<int> deferred;   // lanes sent to the scalar CPU this step
+
+    uint64_t laneSteps = 0, laneInstrs = 0, scalarInstrs = 0;
+
+    void storeRegisters(int l, const CPU::Registers& r);
+    void runScalar();
+    void runLanes();
+    bool stepLanes(uint16_t at);
+    void stepScalar(int l);
+};
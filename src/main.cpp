@@ -1,75 +1,67 @@
-#include "bus.h"
-#include "cpu.h"
-#include "ppu.h"
-#include "apu.h"
-#include "cartridge.h"
-#include "controller.h"
+#include "console.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "audio.h"
+#include "triple.h"
+#include "palette.h"
+#include "ntsc.h"
+#include "upscale.h"
 
 #include <SDL3/SDL.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <iostream>
+#include <iomanip>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        std::cerr << "Usage: ./nes <rom.nes>\n";
+    int runAheadFrames = 0;
+    int audioLatencyMs = 40;
+    bool ntsc = false;
+    bool composite = false;
+    std::unique_ptr<Upscaler> upscaler;
+    bool usage = argc < 2;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--run-ahead" && i + 1 < argc) {
+            runAheadFrames = std::clamp(std::atoi(argv[++i]), 0, RunAhead::MAX_FRAMES);
+        } else if (arg == "--audio-latency-ms" && i + 1 < argc) {
+            audioLatencyMs = std::atoi(argv[++i]);
+        } else if (arg == "--ntsc-palette") {
+            ntsc = true;
+        } else if (arg == "--ntsc") {
+            composite = true;
+        } else if (Upscaler::Filter filter; arg == "--upscale" && i + 1 < argc &&
+                   Upscaler::parse(argv[++i], filter)) {
+            upscaler = std::make_unique<Upscaler>(filter);
+        } else {
+            usage = true;
+        }
+    }
+    if (usage || (composite && upscaler)) {
+        std::cerr << "Usage: ./nes <rom.nes> [--run-ahead N] [--audio-latency-ms N] [--ntsc-palette]\n"
+                     "             [--ntsc | --upscale hq2x|hq3x|xbrz2|xbrz3|xbrz4]\n";
         return 1;
     }
 
-    // Load ROM
-    Cartridge cartridge;
-    if (!cartridge.load(argv[1])) {
+    Console nes;
+    if (!nes.load(argv[1])) {
         return 1;
     }
 
-    // Create components
-    CPU cpu;
-    PPU ppu;
-    APU apuUnit;
-    Bus bus;
-    Controller ctrl1, ctrl2;
-
-    // Wire everything together
-    bus.connectCPU(&cpu);
-    bus.connectPPU(&ppu);
-    bus.connectAPU(&apuUnit);
-    bus.connectCartridge(&cartridge);
-    bus.connectController(&ctrl1, &ctrl2);
-    cpu.connectBus(&bus);
-    ppu.connectCartridge(&cartridge);
-
-    // Reset CPU
-    cpu.reset();
-
     // Initialize SDL3
     if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO)) {
         std::cerr << "SDL_Init failed: " << SDL_GetError() << "\n";
         return 1;
     }
 
-    // Setup audio
-    SDL_AudioSpec audioSpec{};
-    audioSpec.freq = APU::SAMPLE_RATE;
-    audioSpec.format = SDL_AUDIO_F32;
-    audioSpec.channels = 1;
-
-    SDL_AudioStream* audioStream = SDL_OpenAudioDeviceStream(
-        SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audioSpec,
-        [](void* userdata, SDL_AudioStream* stream, int additional_amount, int /*total_amount*/) {
-            APU* apu = static_cast<APU*>(userdata);
-            int numSamples = additional_amount / sizeof(float);
-            if (numSamples <= 0) return;
-            std::vector<float> buffer(numSamples);
-            apu->fillBuffer(buffer.data(), numSamples);
-            SDL_PutAudioStreamData(stream, buffer.data(), numSamples * sizeof(float));
-        },
-        &apuUnit);
-
-    if (!audioStream) {
-        std::cerr << "Warning: Audio init failed: " << SDL_GetError() << "\n";
-    } else {
-        SDL_ResumeAudioStreamDevice(audioStream);
-    }
-
     const int SCALE = 3;
     const int WIDTH = 256 * SCALE;
     const int HEIGHT = 240 * SCALE;
@@ -89,10 +81,15 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // The composite filter outputs three pixels per NES pixel across, an
+    // upscaler its factor both ways
+    const int upscale = upscaler ? upscaler->scale() : 1;
+    const int textureWidth = composite ? NtscFilter::OUT_WIDTH : 256 * upscale;
+    const int textureHeight = 240 * upscale;
     SDL_Texture* texture = SDL_CreateTexture(renderer,
         SDL_PIXELFORMAT_ARGB8888,
         SDL_TEXTUREACCESS_STREAMING,
-        256, 240);
+        textureWidth, textureHeight);
     if (!texture) {
         std::cerr << "SDL_CreateTexture failed: " << SDL_GetError() << "\n";
         SDL_DestroyRenderer(renderer);
@@ -101,21 +98,109 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    SDL_SetTextureScaleMode(texture, SDL_SCALEMODE_NEAREST);
+    // An upscaled frame has smooth edges already; don't make them blocky
+    // again fitting it to the window
+    SDL_SetTextureScaleMode(texture, upscaler ? SDL_SCALEMODE_LINEAR : SDL_SCALEMODE_NEAREST);
 
-    bool running = true;
+    // Setup audio
+    AudioOutput audio(nes.apu);
+    bool audioOpen = audio.open(audioLatencyMs);
 
-    // Frame timing
-    using Clock = std::chrono::high_resolution_clock;
-    auto frameStart = Clock::now();
-    const double frameTime = 1.0 / 60.0; // 60 FPS
+    // Emulation runs on its own thread at the NES's rate; this thread only
+    // handles events and presents. Frames cross over through a triple buffer
+    // and input through atomics, so a stall in the compositor or vsync here
+    // never holds up the emulator (or the audio it feeds).
+    struct Frame { // see palette.h
+        std::array<uint8_t, 256 * 240> pixels;
+        std::array<uint8_t, 240> emphasis;
+    };
+    auto frames = std::make_unique<TripleBuffer<Frame>>();
+    std::atomic<bool> running{true};
+    std::atomic<uint8_t> buttons{0};
+    std::atomic<bool> rewinding{false};
+    std::atomic<int> aheadFrames{runAheadFrames};
+    std::atomic<double> aheadCost{0.0};
+
+    std::thread emulation([&] {
+        // Rewind history: a snapshot per frame, hold R to step back through it
+        Rewind rewind;
+        std::vector<uint8_t> state(nes.bus.stateSize());
+        RunAhead runAhead(nes);
+        bool wasRewinding = false;
+
+        // Frame timing: at the NES's own rate, against an absolute deadline so
+        // sleep rounding doesn't accumulate into drift against the audio clock
+        using Clock = std::chrono::steady_clock;
+        const auto frameTime = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / 60.0988));
+        auto deadline = Clock::now() + frameTime;
+
+        while (running.load(std::memory_order_relaxed)) {
+            runAhead.setFrames(aheadFrames.load(std::memory_order_relaxed));
+
+            // Rewinding restores the previous frame's starting state and runs
+            // that frame again to redraw it. Its input comes back with it: the
+            // buttons are set before the snapshot, which includes them. The
+            // newest snapshot is the start of the frame on screen, so the
+            // first rewound frame skips it rather than showing that frame twice.
+            bool rewindHeld = rewinding.load(std::memory_order_relaxed);
+            bool rewound = false;
+            if (rewindHeld) {
+                if (!wasRewinding) rewind.pop(state);
+                rewound = rewind.pop(state);
+            }
+            wasRewinding = rewindHeld;
+            if (rewound) {
+                nes.bus.loadState(state);
+            } else {
+                nes.ctrl1.setButtonState(buttons.load(std::memory_order_relaxed));
+                nes.bus.saveState(state);
+                rewind.push(state);
+            }
 
-    while (running) {
+            // Run emulation until frame complete
+            runAhead.runFrame();
+            aheadCost.store(runAhead.secondsPerAheadFrame(), std::memory_order_relaxed);
+
+            Frame& frame = frames->back();
+            std::copy_n(nes.frameBuffer(), frame.pixels.size(), frame.pixels.data());
+            std::copy_n(nes.lineEmphasis(), frame.emphasis.size(), frame.emphasis.data());
+            frames->publish();
+
+            // Wait for the deadline; after a long stall start over rather
+            // than rushing frames to catch up
+            auto now = Clock::now();
+            if (now < deadline) {
+                SDL_DelayPrecise((uint64_t)std::chrono::nanoseconds(deadline - now).count());
+                deadline += frameTime;
+            } else {
+                deadline = now + frameTime;
+            }
+        }
+    });
+
+    // With vsync, presenting paces this loop to the display; without it,
+    // poll for the next frame instead
+    bool vsync = SDL_SetRenderVSync(renderer, 1);
+    std::vector<uint32_t> argb(composite ? textureWidth * 240 : 256 * 240);
+    std::vector<uint32_t> scaled(upscaler ? textureWidth * textureHeight : 0);
+    const PaletteLut palette = ntsc ? ntscPalette() : standardPalette();
+    std::unique_ptr<NtscFilter> filter;
+    if (composite) filter = std::make_unique<NtscFilter>();
+    uint64_t filtered = 0;
+    uint64_t presented = 0;
+    uint64_t duplicated = 0;
+
+    while (running.load(std::memory_order_relaxed)) {
         // Handle events
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_EVENT_QUIT) {
                 running = false;
+            } else if (event.type == SDL_EVENT_KEY_DOWN && !event.key.repeat) {
+                int ahead = aheadFrames.load(std::memory_order_relaxed);
+                if (event.key.scancode == SDL_SCANCODE_MINUS) aheadFrames = std::max(0, ahead - 1);
+                if (event.key.scancode == SDL_SCANCODE_EQUALS) aheadFrames = std::min(RunAhead::MAX_FRAMES, ahead + 1);
             }
         }
 
@@ -132,17 +217,27 @@ int main(int argc, char* argv[]) {
         if (keys[SDL_SCANCODE_LEFT])                            btnState |= Controller::Left;
         if (keys[SDL_SCANCODE_RIGHT])                           btnState |= Controller::Right;
 
-        ctrl1.setButtonState(btnState);
+        buttons.store(btnState, std::memory_order_relaxed);
+        rewinding.store(keys[SDL_SCANCODE_R], std::memory_order_relaxed);
 
-        // Run emulation until frame complete
-        ppu.clearFrameReady();
-        while (!ppu.isFrameReady()) {
-            bus.clock();
+        // Update texture with the newest finished frame
+        if (frames->acquire()) {
+            const Frame& frame = frames->front();
+            if (filter) {
+                filter->filter(frame.pixels.data(), frame.emphasis.data(), argb.data(), filtered++);
+            } else {
+                expandFrame(frame.pixels.data(), frame.emphasis.data(), argb.data(), palette);
+            }
+            if (upscaler) upscaler->upscale(argb.data(), scaled.data());
+            SDL_UpdateTexture(texture, nullptr, upscaler ? scaled.data() : argb.data(),
+                              textureWidth * (int)sizeof(uint32_t));
+        } else if (vsync && presented > 0) {
+            duplicated++; // the display refreshed before the emulator finished a frame
+        } else {
+            SDL_Delay(1);
+            continue;
         }
 
-        // Update texture with framebuffer
-        SDL_UpdateTexture(texture, nullptr, ppu.getFrameBuffer(), 256 * sizeof(uint32_t));
-
         // Render
         SDL_RenderClear(renderer);
 
@@ -150,17 +245,37 @@ int main(int argc, char* argv[]) {
         SDL_RenderTexture(renderer, texture, nullptr, &dst);
         SDL_RenderPresent(renderer);
 
-        // Frame timing - wait for remaining time
-        auto frameEnd = Clock::now();
-        double elapsed = std::chrono::duration<double>(frameEnd - frameStart).count();
-        if (elapsed < frameTime) {
-            SDL_Delay((uint32_t)((frameTime - elapsed) * 1000.0));
+        if (++presented % 60 == 0) {
+            std::string title = "NES Emulator";
+            int ahead = aheadFrames.load(std::memory_order_relaxed);
+            if (ahead > 0) {
+                title += " - run-ahead " + std::to_string(ahead) + " (" +
+                         std::to_string((int)(aheadCost.load(std::memory_order_relaxed) * 1e6)) + " us/frame)";
+            }
+            if (audioOpen) {
+                AudioOutput::Stats stats = audio.stats();
+                title += " - audio " + std::to_string((int)std::lround(stats.latencyMs)) + " ms";
+                if (stats.underruns > 0) title += ", " + std::to_string(stats.underruns) + " underruns";
+            }
+            SDL_SetWindowTitle(window, title.c_str());
         }
-        frameStart = Clock::now();
     }
 
-    if (audioStream) {
-        SDL_DestroyAudioStream(audioStream);
+    emulation.join();
+    std::cerr << "Video: " << presented << " frames presented, " << frames->droppedCount()
+              << " dropped, " << duplicated << " duplicated\n";
+
+    if (audioOpen) {
+        audio.close();
+        AudioOutput::Stats stats = audio.stats();
+        std::cerr << "Audio: " << std::fixed << std::setprecision(1) << stats.latencyMs
+                  << " ms latency (target " << audioLatencyMs << "), callback jitter "
+                  << stats.jitterMs << " ms mean / " << stats.maxJitterMs << " ms max, "
+                  << stats.underruns << " underruns in " << stats.callbacks << " callbacks\n";
+        if (nes.apu.overflowSamples() || nes.apu.underrunSamples()) {
+            std::cerr << "Audio: " << nes.apu.overflowSamples() << " samples dropped, "
+                      << nes.apu.underrunSamples() << " samples padded\n";
+        }
     }
     SDL_DestroyTexture(texture);
     SDL_DestroyRenderer(renderer);
@@ -0,0 +1,186 @@
+#include "ntsc.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int SAMPLES_PER_PIXEL = 8;
+constexpr int SAMPLES_PER_CYCLE = 12;
+constexpr int LINES_PER_BAND = 16;
+
+// FCC YIQ -> RGB, and its inverse
+constexpr double yiqToRgb[3][3] = {
+    { 1.0,  0.946882,  0.623557 },
+    { 1.0, -0.274788, -0.635691 },
+    { 1.0, -1.108545,  1.709007 },
+};
+
+struct Rgb { double r, g, b; };
+
+Rgb toRgb(double y, double i, double q) {
+    return { yiqToRgb[0][0] * y + yiqToRgb[0][1] * i + yiqToRgb[0][2] * q,
+             yiqToRgb[1][0] * y + yiqToRgb[1][1] * i + yiqToRgb[1][2] * q,
+             yiqToRgb[2][0] * y + yiqToRgb[2][1] * i + yiqToRgb[2][2] * q };
+}
+
+void toYiq(const Rgb& c, double& y, double& i, double& q) {
+    const auto& m = yiqToRgb;
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                 m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                 m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    auto cofactor = [&](int r, int col) {
+        int r0 = (r + 1) % 3, r1 = (r + 2) % 3, c0 = (col + 1) % 3, c1 = (col + 2) % 3;
+        return m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+    };
+    // inverse[a][b] = cofactor(b, a) / det
+    double v[3] = { c.r, c.g, c.b };
+    double out[3];
+    for (int a = 0; a < 3; a++) {
+        out[a] = (cofactor(0, a) * v[0] + cofactor(1, a) * v[1] + cofactor(2, a) * v[2]) / det;
+    }
+    y = out[0]; i = out[1]; q = out[2];
+}
+
+} // namespace
+
+NtscFilter::NtscFilter(int threads, const NtscParams& params)
+    : pool(threads), kernels((size_t)3 * 512 * KERNEL_SIZE) {
+    // Signal model as in ntscPalette(): levels of the square wave's halves
+    // per luma row, black/white references and the emphasis attenuation
+    static constexpr double levels[8] = { 0.350, 0.518, 0.962, 1.550,
+                                          1.094, 1.506, 1.962, 1.962 };
+    constexpr double black = 0.518, white = 1.962, attenuation = 0.746;
+    const double pi = 3.14159265358979323846;
+    auto wave = [](int p, int color) { return (color + p + 8) % 12 < 6; };
+
+    const double offset = 0.5 * (1.0 - params.contrast) * params.brightness;
+    for (int c = 0; c < 3; c++) bias[c] = (float)(offset * 255.0);
+    bias[3] = 255.0f; // alpha
+
+    for (int entry = 0; entry < 512; entry++) {
+        int color = entry & 0x0F;
+        int level = color < 0x0E ? (entry >> 4) & 3 : 1;
+        int emphasis = entry >> 6;
+        double lo = levels[level + 4 * (color == 0x0)];
+        double hi = levels[level + 4 * (color < 0xD)];
+
+        // Normalized signal at subcarrier phase p
+        auto signal = [&](int p) {
+            double spot = wave(p, color) ? hi : lo;
+            if (((emphasis & 1) && wave(p, 12)) || ((emphasis & 2) && wave(p, 4)) ||
+                ((emphasis & 4) && wave(p, 8))) {
+                spot *= attenuation;
+            }
+            return (spot - black) / (white - black) * params.contrast * params.brightness;
+        };
+
+        // The decoded colour of a flat area, and what it should come out as
+        // once the source gamma is converted. The kernels are linear in the
+        // signal, so the gamma curve can't be applied to their sum cheaply;
+        // instead each colour's luma and chroma parts are rescaled so flat
+        // areas land exactly on the corrected colour (edges approximate it).
+        double y = 0.0, i = 0.0, q = 0.0;
+        for (int p = 0; p < SAMPLES_PER_CYCLE; p++) {
+            double v = signal(p) / SAMPLES_PER_CYCLE;
+            y += v;
+            i += v * std::cos(pi / 6.0 * (p + params.hue));
+            q += v * std::sin(pi / 6.0 * (p + params.hue));
+        }
+        std::complex<double> chroma(i * params.saturation, q * params.saturation);
+        Rgb flat = toRgb(y, chroma.real(), chroma.imag());
+        auto correct = [&](double v) {
+            v = std::clamp(v + offset, 0.0, 1.0);
+            return std::pow(v, 2.2 / params.gamma) - offset;
+        };
+        double yTarget, iTarget, qTarget;
+        toYiq({ correct(flat.r), correct(flat.g), correct(flat.b) }, yTarget, iTarget, qTarget);
+        double lumaScale = std::abs(y) > 1e-9 ? yTarget / y : 1.0;
+        std::complex<double> chromaScale = std::abs(chroma) > 1e-9
+            ? std::complex<double>(iTarget, qTarget) / chroma : 0.0;
+
+        for (int phase = 0; phase < 3; phase++) {
+            float* k = kernels.data() + ((size_t)phase * 512 + entry) * KERNEL_SIZE;
+            for (int d = 0; d < REACH; d++) {
+                // Centre of output pixel d - REACH_BEFORE in signal samples,
+                // relative to the first sample of this NES pixel
+                double centre = (d - REACH_BEFORE + 0.5) * SAMPLES_PER_PIXEL / 3.0;
+                double ky = 0.0, ki = 0.0, kq = 0.0;
+                for (int n = 0; n < SAMPLES_PER_PIXEL; n++) {
+                    int p = (phase * 4 + n) % SAMPLES_PER_CYCLE;
+                    double v = signal(p);
+
+                    // Luma: one subcarrier cycle around the centre; chroma: two
+                    double distance = std::abs(n + 0.5 - centre);
+                    if (distance < SAMPLES_PER_CYCLE / 2) ky += v / SAMPLES_PER_CYCLE;
+                    if (distance < SAMPLES_PER_CYCLE) {
+                        ki += v * std::cos(pi / 6.0 * (p + params.hue)) / (2 * SAMPLES_PER_CYCLE);
+                        kq += v * std::sin(pi / 6.0 * (p + params.hue)) / (2 * SAMPLES_PER_CYCLE);
+                    }
+                }
+                std::complex<double> kc = std::complex<double>(ki, kq) * params.saturation * chromaScale;
+                Rgb rgb = toRgb(ky * lumaScale, kc.real(), kc.imag());
+
+                // Stored in ARGB's byte order, scaled to 0-255
+                k[d * CHANNELS + 0] = (float)(rgb.b * 255.0);
+                k[d * CHANNELS + 1] = (float)(rgb.g * 255.0);
+                k[d * CHANNELS + 2] = (float)(rgb.r * 255.0);
+                k[d * CHANNELS + 3] = 0.0f;
+            }
+        }
+    }
+}
+
+void NtscFilter::filterLine(const uint8_t* indices, int emphasis, int phase, uint32_t* out) const {
+    // Sum of every NES pixel's contributions, REACH_BEFORE outputs of slack
+    // on the left and the rest of the reach on the right. The fixed-length
+    // inner loop is left to the compiler, which vectorizes it (AVX2 with
+    // NES_NATIVE).
+    float acc[(OUT_WIDTH + REACH) * CHANNELS] = {};
+    int base = emphasis << 6;
+    for (int x = 0; x < 256; x++) {
+        // Each pixel starts 8 samples, i.e. two thirds of a cycle, later
+        const float* k = kernel((phase + 2 * x) % 3, base | indices[x]);
+        float* a = acc + 3 * x * CHANNELS;
+        for (int j = 0; j < KERNEL_SIZE; j++) a[j] += k[j];
+    }
+
+    // Round to bytes with saturation: that is the clamp to 0-255 as well
+    const float* a = acc + REACH_BEFORE * CHANNELS;
+#if defined(__SSE2__)
+    const __m128 b = _mm_loadu_ps(bias);
+    for (int x = 0; x < OUT_WIDTH; x += 4, a += 4 * CHANNELS) {
+        __m128i p0 = _mm_cvtps_epi32(_mm_add_ps(_mm_loadu_ps(a + 0), b));
+        __m128i p1 = _mm_cvtps_epi32(_mm_add_ps(_mm_loadu_ps(a + 4), b));
+        __m128i p2 = _mm_cvtps_epi32(_mm_add_ps(_mm_loadu_ps(a + 8), b));
+        __m128i p3 = _mm_cvtps_epi32(_mm_add_ps(_mm_loadu_ps(a + 12), b));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(p0, p1), _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), bytes);
+    }
+#else
+    for (int x = 0; x < OUT_WIDTH; x++, a += CHANNELS) {
+        uint32_t argb = 0;
+        for (int c = 0; c < CHANNELS; c++) {
+            argb |= (uint32_t)std::clamp(std::lround(a[c] + bias[c]), 0L, 255L) << (8 * c);
+        }
+        out[x] = argb;
+    }
+#endif
+}
+
+void NtscFilter::filter(const uint8_t* indices, const uint8_t* emphasis, uint32_t* out, uint64_t frame) {
+    // Each line starts a third of a subcarrier cycle after the previous one,
+    // and a whole frame (one dot shorter every other frame) shifts it by
+    // another third or two thirds, alternating
+    int framePhase = (frame & 1) ? 1 : 0;
+    pool.parallelFor(HEIGHT / LINES_PER_BAND, [&](size_t band) {
+        for (int line = (int)band * LINES_PER_BAND; line < ((int)band + 1) * LINES_PER_BAND; line++) {
+            filterLine(indices + line * 256, emphasis[line] & 7, (framePhase + line) % 3,
+                       out + (size_t)line * OUT_WIDTH);
+        }
+    });
+}
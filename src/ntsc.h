@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "palette.h"
+#include "threadpool.h"
+
+// Composite video filter: turns the PPU's palette indices into the picture a
+// TV decodes from the NES's NTSC signal, dot crawl and colour bleed included,
+// at three output pixels per NES pixel.
+//
+// The PPU draws each pixel as 8 samples of a square wave (12 samples per
+// colour subcarrier cycle); the decoder takes luma as the average over one
+// subcarrier cycle and chroma by demodulating over two. All of that is linear
+// in the signal, so every output pixel is a sum of fixed contributions from
+// the four NES pixels around it. Those contributions are tabulated per
+// colour, emphasis and subcarrier phase when the filter is built, and a frame
+// is just vectorized table additions and a saturating pack to bytes, split
+// into bands of lines across a thread pool.
+class NtscFilter {
+public:
+    static constexpr int OUT_WIDTH = 256 * 3;
+    static constexpr int HEIGHT = 240;
+
+    explicit NtscFilter(int threads = 2, const NtscParams& params = {});
+
+    // Filter a frame of indices with per-line emphasis (see palette.h) into
+    // OUT_WIDTH x HEIGHT ARGB. `frame` counts frames: the subcarrier phase
+    // alternates between consecutive frames, which makes the dots crawl.
+    void filter(const uint8_t* indices, const uint8_t* emphasis, uint32_t* out, uint64_t frame);
+
+private:
+    // Output pixels one NES pixel reaches: from 4 before its first to 7 after
+    static constexpr int REACH_BEFORE = 4;
+    static constexpr int REACH = 12;
+    static constexpr int CHANNELS = 4; // B, G, R, A: ARGB's byte order
+    static constexpr int KERNEL_SIZE = REACH * CHANNELS;
+
+    ThreadPool pool;
+    std::vector<float> kernels; // [phase 0-2][entry 0-511][REACH][CHANNELS], 0-255 scale
+    float bias[CHANNELS] = {};  // added to every output: contrast offset, opaque alpha
+
+    const float* kernel(int phase, int entry) const {
+        return kernels.data() + ((size_t)phase * 512 + entry) * KERNEL_SIZE;
+    }
+    void filterLine(const uint8_t* indices, int emphasis, int phase, uint32_t* out) const;
+};
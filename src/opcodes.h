@@ -0,0 +1,151 @@
+#pragma once
+#include "cpu.h"
+#include <array>
+#include <cstdint>
+#include <utility>
+
+// The 6502 instruction set as data, shared by the interpreter, the block
+// cache and the JIT
+namespace opcodes {
+
+using Mode = CPU::AddrMode;
+
+enum class Op : uint8_t {
+    ADC, SBC, AND, ORA, EOR, CMP, CPX, CPY, BIT,
+    LDA, LDX, LDY, STA, STX, STY,
+    INC, DEC, INX, INY, DEX, DEY,
+    ASL, LSR, ROL, ROR,
+    BCC, BCS, BEQ, BNE, BMI, BPL, BVC, BVS,
+    JMP, JSR, RTS, RTI, BRK,
+    TAX, TXA, TAY, TYA, TXS, TSX,
+    PHA, PLA, PHP, PLP,
+    CLC, SEC, CLD, SED, CLI, SEI, CLV,
+    NOP,
+    DOP, TOP,  // unofficial NOPs that skip their operand without reading it
+    LAX, SAX, DCP, ISB, SLO, RLA, SRE, RRA
+};
+
+struct OpInfo {
+    Op op;
+    Mode mode;
+    uint8_t cycles;    // base cycle count
+    bool pagePenalty;  // +1 cycle when the indexed address crosses a page
+};
+
+// Every opcode in one place. Anything not listed is a 2-cycle NOP.
+inline constexpr std::array<OpInfo, 256> opTable = [] {
+    std::array<OpInfo, 256> t{};
+    t.fill({Op::NOP, Mode::IMP, 2, false});
+    auto set = [&](uint8_t code, Op op, Mode mode, uint8_t cycles, bool pagePenalty = false) {
+        t[code] = {op, mode, cycles, pagePenalty};
+    };
+
+    // Loads, ALU and compares: the indexed reads pay for a page cross
+    for (auto [op, base] : {std::pair{Op::ORA, 0x00}, {Op::AND, 0x20}, {Op::EOR, 0x40},
+                            {Op::ADC, 0x60}, {Op::LDA, 0xA0}, {Op::CMP, 0xC0}, {Op::SBC, 0xE0}}) {
+        set(base + 0x09, op, Mode::IMM, 2);
+        set(base + 0x05, op, Mode::ZP,  3);
+        set(base + 0x15, op, Mode::ZPX, 4);
+        set(base + 0x0D, op, Mode::ABS, 4);
+        set(base + 0x1D, op, Mode::ABX, 4, true);
+        set(base + 0x19, op, Mode::ABY, 4, true);
+        set(base + 0x01, op, Mode::IZX, 6);
+        set(base + 0x11, op, Mode::IZY, 5, true);
+    }
+    set(0xE0, Op::CPX, Mode::IMM, 2); set(0xE4, Op::CPX, Mode::ZP, 3); set(0xEC, Op::CPX, Mode::ABS, 4);
+    set(0xC0, Op::CPY, Mode::IMM, 2); set(0xC4, Op::CPY, Mode::ZP, 3); set(0xCC, Op::CPY, Mode::ABS, 4);
+    set(0x24, Op::BIT, Mode::ZP, 3);  set(0x2C, Op::BIT, Mode::ABS, 4);
+
+    set(0xA2, Op::LDX, Mode::IMM, 2); set(0xA6, Op::LDX, Mode::ZP, 3); set(0xB6, Op::LDX, Mode::ZPY, 4);
+    set(0xAE, Op::LDX, Mode::ABS, 4); set(0xBE, Op::LDX, Mode::ABY, 4, true);
+    set(0xA0, Op::LDY, Mode::IMM, 2); set(0xA4, Op::LDY, Mode::ZP, 3); set(0xB4, Op::LDY, Mode::ZPX, 4);
+    set(0xAC, Op::LDY, Mode::ABS, 4); set(0xBC, Op::LDY, Mode::ABX, 4, true);
+
+    // Stores always take the indexed worst case
+    set(0x85, Op::STA, Mode::ZP, 3);  set(0x95, Op::STA, Mode::ZPX, 4); set(0x8D, Op::STA, Mode::ABS, 4);
+    set(0x9D, Op::STA, Mode::ABX, 5); set(0x99, Op::STA, Mode::ABY, 5);
+    set(0x81, Op::STA, Mode::IZX, 6); set(0x91, Op::STA, Mode::IZY, 6);
+    set(0x86, Op::STX, Mode::ZP, 3);  set(0x96, Op::STX, Mode::ZPY, 4); set(0x8E, Op::STX, Mode::ABS, 4);
+    set(0x84, Op::STY, Mode::ZP, 3);  set(0x94, Op::STY, Mode::ZPX, 4); set(0x8C, Op::STY, Mode::ABS, 4);
+
+    // Read-modify-write
+    for (auto [op, base] : {std::pair{Op::ASL, 0x00}, {Op::ROL, 0x20}, {Op::LSR, 0x40},
+                            {Op::ROR, 0x60}, {Op::DEC, 0xC0}, {Op::INC, 0xE0}}) {
+        set(base + 0x06, op, Mode::ZP,  5);
+        set(base + 0x16, op, Mode::ZPX, 6);
+        set(base + 0x0E, op, Mode::ABS, 6);
+        set(base + 0x1E, op, Mode::ABX, 7);
+    }
+    set(0x0A, Op::ASL, Mode::ACC, 2); set(0x2A, Op::ROL, Mode::ACC, 2);
+    set(0x4A, Op::LSR, Mode::ACC, 2); set(0x6A, Op::ROR, Mode::ACC, 2);
+    set(0xE8, Op::INX, Mode::IMP, 2); set(0xC8, Op::INY, Mode::IMP, 2);
+    set(0xCA, Op::DEX, Mode::IMP, 2); set(0x88, Op::DEY, Mode::IMP, 2);
+
+    // Branches: +1 if taken, +2 if taken across a page
+    set(0x90, Op::BCC, Mode::REL, 2); set(0xB0, Op::BCS, Mode::REL, 2);
+    set(0xF0, Op::BEQ, Mode::REL, 2); set(0xD0, Op::BNE, Mode::REL, 2);
+    set(0x30, Op::BMI, Mode::REL, 2); set(0x10, Op::BPL, Mode::REL, 2);
+    set(0x50, Op::BVC, Mode::REL, 2); set(0x70, Op::BVS, Mode::REL, 2);
+
+    set(0x4C, Op::JMP, Mode::ABS, 3); set(0x6C, Op::JMP, Mode::IND, 5);
+    set(0x20, Op::JSR, Mode::ABS, 6); set(0x60, Op::RTS, Mode::IMP, 6);
+    set(0x40, Op::RTI, Mode::IMP, 6); set(0x00, Op::BRK, Mode::IMP, 7);
+
+    set(0xAA, Op::TAX, Mode::IMP, 2); set(0x8A, Op::TXA, Mode::IMP, 2);
+    set(0xA8, Op::TAY, Mode::IMP, 2); set(0x98, Op::TYA, Mode::IMP, 2);
+    set(0x9A, Op::TXS, Mode::IMP, 2); set(0xBA, Op::TSX, Mode::IMP, 2);
+    set(0x48, Op::PHA, Mode::IMP, 3); set(0x68, Op::PLA, Mode::IMP, 4);
+    set(0x08, Op::PHP, Mode::IMP, 3); set(0x28, Op::PLP, Mode::IMP, 4);
+
+    set(0x18, Op::CLC, Mode::IMP, 2); set(0x38, Op::SEC, Mode::IMP, 2);
+    set(0xD8, Op::CLD, Mode::IMP, 2); set(0xF8, Op::SED, Mode::IMP, 2);
+    set(0x58, Op::CLI, Mode::IMP, 2); set(0x78, Op::SEI, Mode::IMP, 2);
+    set(0xB8, Op::CLV, Mode::IMP, 2);
+
+    // Unofficial NOPs (common ones games use)
+    for (uint8_t code : {0x04, 0x44, 0x64}) set(code, Op::DOP, Mode::IMP, 3);
+    for (uint8_t code : {0x14, 0x34, 0x54, 0x74, 0xD4, 0xF4}) set(code, Op::DOP, Mode::IMP, 4);
+    for (uint8_t code : {0x80, 0x82, 0x89, 0xC2, 0xE2}) set(code, Op::DOP, Mode::IMP, 2);
+    set(0x0C, Op::TOP, Mode::IMP, 4);
+    for (uint8_t code : {0x1C, 0x3C, 0x5C, 0x7C, 0xDC, 0xFC}) set(code, Op::NOP, Mode::ABX, 4, true);
+
+    // Unofficial loads/stores and combined read-modify-write ops
+    set(0xA7, Op::LAX, Mode::ZP, 3);  set(0xB7, Op::LAX, Mode::ZPY, 4); set(0xAF, Op::LAX, Mode::ABS, 4);
+    set(0xBF, Op::LAX, Mode::ABY, 4, true);
+    set(0xA3, Op::LAX, Mode::IZX, 6); set(0xB3, Op::LAX, Mode::IZY, 5, true);
+    set(0x87, Op::SAX, Mode::ZP, 3);  set(0x97, Op::SAX, Mode::ZPY, 4); set(0x8F, Op::SAX, Mode::ABS, 4);
+    set(0x83, Op::SAX, Mode::IZX, 6);
+    for (auto [op, base] : {std::pair{Op::SLO, 0x00}, {Op::RLA, 0x20}, {Op::SRE, 0x40},
+                            {Op::RRA, 0x60}, {Op::DCP, 0xC0}, {Op::ISB, 0xE0}}) {
+        set(base + 0x07, op, Mode::ZP,  5);
+        set(base + 0x17, op, Mode::ZPX, 6);
+        set(base + 0x0F, op, Mode::ABS, 6);
+        set(base + 0x1F, op, Mode::ABX, 7);
+        set(base + 0x1B, op, Mode::ABY, 7);
+        set(base + 0x03, op, Mode::IZX, 8);
+        set(base + 0x13, op, Mode::IZY, 8);
+    }
+    return t;
+}();
+
+inline constexpr int operandBytes(Mode mode) {
+    switch (mode) {
+        case Mode::IMP: case Mode::ACC: return 0;
+        case Mode::ABS: case Mode::ABX: case Mode::ABY: case Mode::IND: return 2;
+        default: return 1;
+    }
+}
+
+// Anything that can move pc somewhere other than the next instruction
+inline constexpr bool endsBlock(Op op) {
+    switch (op) {
+        case Op::BCC: case Op::BCS: case Op::BEQ: case Op::BNE:
+        case Op::BMI: case Op::BPL: case Op::BVC: case Op::BVS:
+        case Op::JMP: case Op::JSR: case Op::RTS: case Op::RTI: case Op::BRK:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace opcodes
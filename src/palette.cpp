@@ -0,0 +1,126 @@
+#include "palette.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// NES system palette - 64 colors mapped to ARGB
+const uint32_t nesPalette[64] = {
+    0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4,
+    0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
+    0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08,
+    0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE,
+    0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
+    0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32,
+    0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF,
+    0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
+    0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082,
+    0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
+    0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF,
+    0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
+    0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC,
+    0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000,
+};
+
+const PaletteLut& standardPalette() {
+    static const PaletteLut lut = [] {
+        PaletteLut t{};
+        for (int e = 0; e < 8; e++) {
+            // Emphasizing one channel darkens the other two
+            double scale[3] = { 1.0, 1.0, 1.0 }; // R, G, B
+            for (int c = 0; c < 3; c++) {
+                if (e & (1 << c)) {
+                    for (int other = 0; other < 3; other++) {
+                        if (other != c) scale[other] *= 0.816;
+                    }
+                }
+            }
+            for (int i = 0; i < 64; i++) {
+                uint32_t argb = 0xFF000000;
+                for (int c = 0; c < 3; c++) {
+                    int shift = 16 - 8 * c;
+                    uint32_t v = (nesPalette[i] >> shift) & 0xFF;
+                    argb |= (uint32_t)std::lround(v * scale[c]) << shift;
+                }
+                t[e << 6 | i] = argb;
+            }
+        }
+        return t;
+    }();
+    return lut;
+}
+
+PaletteLut ntscPalette(const NtscParams& params) {
+    // Signal levels (relative to sync) of the four luma rows, low then high
+    // half of the square wave, and the levels that map to black and white
+    static constexpr double levels[8] = { 0.350, 0.518, 0.962, 1.550,
+                                          1.094, 1.506, 1.962, 1.962 };
+    constexpr double black = 0.518, white = 1.962, attenuation = 0.746;
+    const double pi = 3.14159265358979323846;
+
+    // Phase p of the 12 the subcarrier is split into is "high" for hue `color`
+    auto wave = [](int p, int color) { return (color + p + 8) % 12 < 6; };
+    auto channel = [&](double v) {
+        v = v <= 0.0 ? 0.0 : std::pow(v, 2.2 / params.gamma);
+        return (uint32_t)std::clamp(v * 255.95, 0.0, 255.0);
+    };
+
+    PaletteLut t{};
+    for (int entry = 0; entry < 512; entry++) {
+        int color = entry & 0x0F;
+        int level = color < 0x0E ? (entry >> 4) & 3 : 1;
+        int emphasis = entry >> 6;
+
+        // Hue 0 is a flat high level, hues $D-$F a flat low one
+        double lo = levels[level + 4 * (color == 0x0)];
+        double hi = levels[level + 4 * (color < 0xD)];
+
+        double y = 0.0, i = 0.0, q = 0.0;
+        for (int p = 0; p < 12; p++) {
+            double spot = wave(p, color) ? hi : lo;
+            if (((emphasis & 1) && wave(p, 12)) || ((emphasis & 2) && wave(p, 4)) ||
+                ((emphasis & 4) && wave(p, 8))) {
+                spot *= attenuation;
+            }
+            double v = (spot - black) / (white - black);
+            v = ((v - 0.5) * params.contrast + 0.5) * params.brightness / 12.0;
+            y += v;
+            i += v * std::cos(pi / 6.0 * (p + params.hue));
+            q += v * std::sin(pi / 6.0 * (p + params.hue));
+        }
+        i *= params.saturation;
+        q *= params.saturation;
+
+        // FCC YIQ -> RGB
+        t[entry] = 0xFF000000 |
+                   channel(y + 0.946882 * i + 0.623557 * q) << 16 |
+                   channel(y - 0.274788 * i - 0.635691 * q) << 8 |
+                   channel(y - 1.108545 * i + 1.709007 * q);
+    }
+    return t;
+}
+
+void expandFrame(const uint8_t* indices, const uint8_t* emphasis, uint32_t* argb,
+                 const PaletteLut& lut) {
+    for (int line = 0; line < 240; line++) {
+        // The line's emphasis picks one 64-colour slice of the table
+        const uint32_t* colors = lut.data() + ((emphasis[line] & 7) << 6);
+        const uint8_t* in = indices + line * 256;
+        uint32_t* out = argb + line * 256;
+#if defined(__AVX2__)
+        // Eight pixels per step: widen the indices to 32 bits and gather
+        for (int x = 0; x < 256; x += 8) {
+            __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + x));
+            __m256i idx = _mm256_cvtepu8_epi32(bytes);
+            __m256i pixels = _mm256_i32gather_epi32(reinterpret_cast<const int*>(colors), idx, 4);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), pixels);
+        }
+#else
+        for (int x = 0; x < 256; x++) out[x] = colors[in[x]];
+#endif
+    }
+}
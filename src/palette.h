@@ -0,0 +1,38 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// The PPU draws palette indices, one byte per pixel (the 6-bit NES colour
+// number, with PPUMASK's grayscale already applied) plus the colour-emphasis
+// bits of each line; these turn them into ARGB only when a frame is actually
+// shown or saved, so the PPU's inner loops never touch colours and a frame
+// costs 60KB instead of 240KB.
+
+// NES system palette, colour number -> ARGB
+extern const uint32_t nesPalette[64];
+
+// Every colour under every emphasis setting: entry (emphasis << 6) | colour,
+// emphasis being PPUMASK bits 5-7 (red, green, blue on NTSC)
+using PaletteLut = std::array<uint32_t, 512>;
+
+// nesPalette, with each emphasis bit dimming the two other channels
+const PaletteLut& standardPalette();
+
+// A palette decoded from a model of the PPU's composite signal: per colour
+// the two voltage levels of its square wave, emphasis attenuating phases of
+// it, then an ideal YIQ demodulator. Built once per call, so keep the result.
+struct NtscParams {
+    double hue = 0.0;        // in 30-degree steps of the colour subcarrier
+    double saturation = 1.0;
+    double contrast = 1.0;
+    double brightness = 1.0;
+    double gamma = 1.8;      // of the source; the output is converted to 2.2
+};
+PaletteLut ntscPalette(const NtscParams& params = {});
+
+// Expand a 256x240 frame of indices into ARGB, `emphasis` holding each line's
+// emphasis bits (0-7). Uses AVX2 gathers when the build enables them
+// (NES_NATIVE), otherwise a plain table lookup.
+void expandFrame(const uint8_t* indices, const uint8_t* emphasis, uint32_t* argb,
+                 const PaletteLut& lut = standardPalette());
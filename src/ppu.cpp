@@ -1,32 +1,10 @@
 #include "ppu.h"
+#include "state.h"
 #include "cartridge.h"
-
-// NES system palette - 64 colors mapped to ARGB
-static const uint32_t nesPalette[64] = {
-    0xFF666666, 0xFF002A88, 0xFF1412A7, 0xFF3B00A4,
-    0xFF5C007E, 0xFF6E0040, 0xFF6C0600, 0xFF561D00,
-    0xFF333500, 0xFF0B4800, 0xFF005200, 0xFF004F08,
-    0xFF00404D, 0xFF000000, 0xFF000000, 0xFF000000,
-    0xFFADADAD, 0xFF155FD9, 0xFF4240FF, 0xFF7527FE,
-    0xFFA01ACC, 0xFFB71E7B, 0xFFB53120, 0xFF994E00,
-    0xFF6B6D00, 0xFF388700, 0xFF0C9300, 0xFF008F32,
-    0xFF007C8D, 0xFF000000, 0xFF000000, 0xFF000000,
-    0xFFFFFEFF, 0xFF64B0FF, 0xFF9290FF, 0xFFC676FF,
-    0xFFF36AFF, 0xFFFE6ECC, 0xFFFE8170, 0xFFEA9E22,
-    0xFFBCBE00, 0xFF88D800, 0xFF5CE430, 0xFF45E082,
-    0xFF48CDDE, 0xFF4F4F4F, 0xFF000000, 0xFF000000,
-    0xFFFFFEFF, 0xFFC0DFFF, 0xFFD3D2FF, 0xFFE8C8FF,
-    0xFFFBC2FF, 0xFFFEC4EA, 0xFFFECCC5, 0xFFF7D8A5,
-    0xFFE4E594, 0xFFCFEF96, 0xFFBDF4AB, 0xFFB3F3CC,
-    0xFFB5EBF2, 0xFFB8B8B8, 0xFF000000, 0xFF000000,
-};
+#include <algorithm>
 
 PPU::PPU() {
-    frameBuffer.fill(0xFF000000);
-}
-
-uint32_t PPU::nesColor(uint8_t idx) {
-    return nesPalette[idx & 0x3F];
+    frameBuffer.fill(0x0F); // black
 }
 
 uint16_t PPU::mirrorNametable(uint16_t addr) {
@@ -116,6 +94,7 @@ void PPU::cpuWrite(uint16_t addr, uint8_t val) {
             break;
         case 1: // PPUMASK
             mask = val;
+            colorMask = (val & 0x01) ? 0x30 : 0x3F; // grayscale keeps only the luma row
             break;
         case 3: // OAMADDR
             oamAddr = val;
@@ -241,24 +220,9 @@ void PPU::evaluateSprites() {
                 patternAddr = table + tileNum * 16 + row;
             }
 
-            uint8_t lo = ppuRead(patternAddr);
-            uint8_t hi = ppuRead(patternAddr + 8);
-
-            // Horizontal flip
-            if (s.attr & 0x40) {
-                // Reverse bits
-                auto flipByte = [](uint8_t b) -> uint8_t {
-                    b = ((b & 0xF0) >> 4) | ((b & 0x0F) << 4);
-                    b = ((b & 0xCC) >> 2) | ((b & 0x33) << 2);
-                    b = ((b & 0xAA) >> 1) | ((b & 0x55) << 1);
-                    return b;
-                };
-                lo = flipByte(lo);
-                hi = flipByte(hi);
-            }
-
-            spriteShiftLo[spriteCount] = lo;
-            spriteShiftHi[spriteCount] = hi;
+            // Horizontal flip comes pre-decoded
+            const Cartridge::TileRow& pattern = patternRow(patternAddr);
+            spriteRows[spriteCount] = (s.attr & 0x40) ? pattern.flipped : pattern.plain;
             spriteCount++;
         }
     }
@@ -267,6 +231,7 @@ void PPU::evaluateSprites() {
 void PPU::renderPixel() {
     int x = cycle - 1;
     if (x < 0 || x >= 256 || scanline < 0 || scanline >= 240) return;
+    if (!output && (sprite0Hit || !sprite0OnLine)) return;
 
     // Background pixel
     uint8_t bgPixel = 0;
@@ -297,10 +262,7 @@ void PPU::renderPixel() {
                 int offset = x - spriteLine[i].x;
                 if (offset < 0 || offset >= 8) continue;
 
-                uint8_t p0 = (spriteShiftLo[i] >> (7 - offset)) & 1;
-                uint8_t p1 = (spriteShiftHi[i] >> (7 - offset)) & 1;
-                uint8_t pixel = (p1 << 1) | p0;
-
+                uint8_t pixel = (spriteRows[i] >> (14 - 2 * offset)) & 0x03;
                 if (pixel == 0) continue;
 
                 sprPixel = pixel;
@@ -339,8 +301,202 @@ void PPU::renderPixel() {
         }
     }
 
-    uint8_t colorIdx = ppuRead(0x3F00 + finalPalette * 4 + finalPixel) & 0x3F;
-    frameBuffer[scanline * 256 + x] = nesColor(colorIdx);
+    if (!output) return;
+    // Only entry 0 is read with pixel 0, so the $3F10-style mirrors that
+    // ppuRead() resolves never come up here
+    frameBuffer[scanline * 256 + x] = palette[finalPalette * 4 + finalPixel] & colorMask;
+    if (x == 0) lineEmphasis[scanline] = mask >> 5;
+}
+
+const Cartridge::TileRow& PPU::patternRow(uint16_t addr) const {
+    static const Cartridge::TileRow blank{};
+    return cartridge ? cartridge->tileRow(addr) : blank;
+}
+
+uint16_t PPU::fetchBackgroundTile() {
+    // The four fetches of one 8-dot group followed by the coarse X step.
+    // Returns the pattern row pre-decoded to 2 bits per pixel.
+    ntByte = ppuRead(0x2000 | (vramAddr & 0x0FFF));
+
+    uint16_t atAddr = 0x23C0 | (vramAddr & 0x0C00) |
+                      ((vramAddr >> 4) & 0x38) | ((vramAddr >> 2) & 0x07);
+    atByte = ppuRead(atAddr);
+    if (vramAddr & 0x40) atByte >>= 4;
+    if (vramAddr & 0x02) atByte >>= 2;
+    atLatchLo = atByte & 1;
+    atLatchHi = (atByte >> 1) & 1;
+
+    const Cartridge::TileRow& pattern = patternRow(bgPatternAddress());
+    bgLo = pattern.lo;
+    bgHi = pattern.hi;
+
+    incrementX();
+    return pattern.plain;
+}
+
+void PPU::renderScanline() {
+    // Cycles 0-340 of a visible line in one pass. Only valid when nothing can
+    // touch the PPU mid-line, so per-dot ordering inside the line is moot.
+    uint8_t* line = &frameBuffer[scanline * 256];
+
+    if ((mask & 0x18) == 0) {
+        // Rendering off: every pixel is the backdrop colour
+        if (output) {
+            std::fill(line, line + 256, (uint8_t)(palette[0] & colorMask));
+            lineEmphasis[scanline] = mask >> 5;
+        }
+        cycle = 0;
+        scanline++;
+        return;
+    }
+
+    bool showBg = (mask & 0x08) != 0;
+
+    uint16_t lo = bgShiftLo, hi = bgShiftHi;
+    uint16_t alo = atShiftLo, ahi = atShiftHi;
+
+    // One fetch group: shift (if the background is on), reload the low byte
+    // from the latches, fetch the next tile, then seven more shifts
+    auto beginGroup = [&]() {
+        if (showBg) { lo <<= 1; hi <<= 1; alo <<= 1; ahi <<= 1; }
+        lo  = (lo  & 0xFF00) | bgLo;
+        hi  = (hi  & 0xFF00) | bgHi;
+        alo = (alo & 0xFF00) | (atLatchLo ? 0xFF : 0x00);
+        ahi = (ahi & 0xFF00) | (atLatchHi ? 0xFF : 0x00);
+    };
+    auto endGroup = [&]() {
+        if (showBg) { lo <<= 7; hi <<= 7; alo <<= 7; ahi <<= 7; }
+    };
+
+    // Background: 2-bit pixel | palette << 2, 0 where hidden. The first
+    // group reads whatever the shifters held at the start of the line; from
+    // then on the shifter high byte is always the previously loaded tile, so
+    // pixels come straight from the decoded rows of the two tiles.
+    uint8_t bgRow[256];
+    uint16_t curRow = Cartridge::packRow(bgLo, bgHi);
+    uint8_t curPal = (uint8_t)(atLatchLo | (atLatchHi << 1));
+    uint16_t prevRow = 0;
+    uint8_t prevPal = 0;
+    for (int g = 0; g < 32; g++) {
+        beginGroup();
+        uint8_t* out = &bgRow[g * 8];
+        if (!showBg) {
+            std::fill(out, out + 8, 0);
+        } else if (g == 0) {
+            for (int i = 0; i < 8; i++) {
+                int bit = 15 - fineX - i;
+                out[i] = (((lo >> bit) & 1) | (((hi >> bit) & 1) << 1) |
+                          (((alo >> bit) & 1) << 2) | (((ahi >> bit) & 1) << 3));
+            }
+        } else {
+            uint32_t pixels = (((uint32_t)prevRow << 16) | curRow) << (2 * fineX);
+            for (int i = 0; i < 8; i++) {
+                uint8_t pal = (i < 8 - fineX) ? prevPal : curPal;
+                out[i] = (uint8_t)((pixels >> 30) | (pal << 2));
+                pixels <<= 2;
+            }
+        }
+        prevRow = curRow;
+        prevPal = curPal;
+        curRow = fetchBackgroundTile();
+        curPal = (uint8_t)(atLatchLo | (atLatchHi << 1));
+        endGroup();
+    }
+    if (!(mask & 0x02)) std::fill(bgRow, bgRow + 8, 0);
+
+    // Sprites: 2-bit pixel | palette << 2 | behind-bg << 4 | sprite 0 << 5.
+    // Walk back to front so the lowest OAM index ends up on top.
+    uint8_t sprRow[256] = {};
+    if (mask & 0x10) {
+        for (int i = spriteCount - 1; i >= 0; i--) {
+            const Sprite& s = spriteLine[i];
+            uint8_t attr = (uint8_t)(((s.attr & 0x03) << 2) | ((s.attr & 0x20) ? 0x10 : 0) |
+                                     ((i == 0 && sprite0OnLine) ? 0x20 : 0));
+            for (int offset = 0; offset < 8 && s.x + offset < 256; offset++) {
+                uint8_t pixel = (spriteRows[i] >> (14 - 2 * offset)) & 0x03;
+                if (pixel) sprRow[s.x + offset] = pixel | attr;
+            }
+        }
+        if (!(mask & 0x04)) std::fill(sprRow, sprRow + 8, 0);
+    }
+
+    // Palette is frozen for the whole line
+    uint8_t colors[32];
+    for (int i = 0; i < 32 && output; i++) {
+        colors[i] = ppuRead(0x3F00 + i) & colorMask;
+    }
+    if (output) lineEmphasis[scanline] = mask >> 5;
+
+    bool hitPossible = (mask & 0x18) == 0x18 && !sprite0Hit && sprite0OnLine;
+    for (int x = 0; x < 256 && (output || hitPossible); x++) {
+        uint8_t bgPixel = bgRow[x] & 0x03;
+        uint8_t spr = sprRow[x];
+        uint8_t sprPixel = spr & 0x03;
+
+        uint8_t index = 0;
+        if (bgPixel == 0) {
+            if (sprPixel) index = 16 + ((spr >> 2) & 0x03) * 4 + sprPixel;
+        } else if (sprPixel == 0) {
+            index = bgRow[x];
+        } else {
+            if ((spr & 0x20) && hitPossible && x < 255 &&
+                !((mask & 0x06) != 0x06 && x < 8)) {
+                sprite0Hit = true;
+                status |= 0x40;
+                hitPossible = false;
+            }
+            index = (spr & 0x10) ? bgRow[x] : 16 + ((spr >> 2) & 0x03) * 4 + sprPixel;
+        }
+        if (output) line[x] = colors[index];
+    }
+
+    // Cycle 256-257: vertical step, horizontal reload, sprites for next line
+    incrementY();
+    transferX();
+    evaluateSprites();
+
+    // Cycles 321-336: first two tiles of the next line
+    for (int g = 0; g < 2; g++) {
+        beginGroup();
+        fetchBackgroundTile();
+        endGroup();
+    }
+
+    bgShiftLo = lo; bgShiftHi = hi;
+    atShiftLo = alo; atShiftHi = ahi;
+
+    cycle = 0;
+    scanline++;
+}
+
+void PPU::run(int dots) {
+    while (dots > 0) {
+        if (cycle == 0 && dots >= 341 && scanline >= 0 && scanline < 240) {
+            renderScanline();
+            dots -= 341;
+            continue;
+        }
+
+        // Dots where clock() would only advance the counters
+        bool idle = (scanline >= 240 && !(scanline == 241 && cycle <= 1)) ||
+                    (scanline == -1 && cycle >= 2 && !(mask & 0x18));
+        if (idle) {
+            int n = std::min(dots, 341 - cycle);
+            dots -= n;
+            cycle += n;
+            if (cycle > 340) {
+                cycle = 0;
+                scanline++;
+                if (scanline > 260) {
+                    scanline = -1;
+                }
+            }
+            continue;
+        }
+
+        clock();
+        dots--;
+    }
 }
 
 void PPU::clock() {
@@ -381,15 +537,17 @@ void PPU::clock() {
                         break;
                     }
                     case 4: {
-                        uint16_t bgTable = (ctrl & 0x10) ? 0x1000 : 0x0000;
-                        uint16_t fineY = (vramAddr >> 12) & 0x07;
-                        bgLo = ppuRead(bgTable + ntByte * 16 + fineY);
+                        // Both planes in one lookup; dot 6 only looks again
+                        // if a register write has moved the address since
+                        bgPatternAddr = bgPatternAddress();
+                        const Cartridge::TileRow& pattern = patternRow(bgPatternAddr);
+                        bgLo = pattern.lo;
+                        bgHi = pattern.hi;
                         break;
                     }
                     case 6: {
-                        uint16_t bgTable = (ctrl & 0x10) ? 0x1000 : 0x0000;
-                        uint16_t fineY = (vramAddr >> 12) & 0x07;
-                        bgHi = ppuRead(bgTable + ntByte * 16 + fineY + 8);
+                        uint16_t addr = bgPatternAddress();
+                        if (addr != bgPatternAddr) bgHi = patternRow(addr).hi;
                         break;
                     }
                     case 7:
@@ -402,7 +560,6 @@ void PPU::clock() {
         // Odd frame cycle skip
         if (cycle == 339 && rendering) {
             // skip to cycle 0 of scanline 0 on odd frames
-            static bool oddFrame = false;
             if (oddFrame) {
                 cycle = 0;
                 scanline = 0;
@@ -437,15 +594,17 @@ void PPU::clock() {
                         break;
                     }
                     case 4: {
-                        uint16_t bgTable = (ctrl & 0x10) ? 0x1000 : 0x0000;
-                        uint16_t fineY = (vramAddr >> 12) & 0x07;
-                        bgLo = ppuRead(bgTable + ntByte * 16 + fineY);
+                        // Both planes in one lookup; dot 6 only looks again
+                        // if a register write has moved the address since
+                        bgPatternAddr = bgPatternAddress();
+                        const Cartridge::TileRow& pattern = patternRow(bgPatternAddr);
+                        bgLo = pattern.lo;
+                        bgHi = pattern.hi;
                         break;
                     }
                     case 6: {
-                        uint16_t bgTable = (ctrl & 0x10) ? 0x1000 : 0x0000;
-                        uint16_t fineY = (vramAddr >> 12) & 0x07;
-                        bgHi = ppuRead(bgTable + ntByte * 16 + fineY + 8);
+                        uint16_t addr = bgPatternAddress();
+                        if (addr != bgPatternAddr) bgHi = patternRow(addr).hi;
                         break;
                     }
                     case 7:
@@ -486,3 +645,52 @@ void PPU::clock() {
         }
     }
 }
+
+int PPU::dotsUntilVblank() const {
+    // Dot positions counted from the start of the pre-render line
+    constexpr int DOTS_PER_LINE = 341;
+    constexpr int FRAME_DOTS = 262 * DOTS_PER_LINE;
+    constexpr int VBLANK_DOT = 242 * DOTS_PER_LINE + 1; // scanline 241, cycle 1
+
+    int pos = (scanline + 1) * DOTS_PER_LINE + cycle;
+    int dots = VBLANK_DOT - pos + 1;
+    bool passesSkip = pos <= 339; // odd-frame check at pre-render cycle 339
+    if (dots <= 0) {
+        dots += FRAME_DOTS;
+        passesSkip = true;
+    }
+    if (passesSkip && (mask & 0x18) && oddFrame) dots--;
+    return dots;
+}
+
+void PPU::saveState(StateWriter& w) const {
+    w.pod(vram); w.pod(palette); w.pod(oam);
+    w.pod(frameReady);
+    w.pod(scanline); w.pod(cycle); w.pod(oddFrame);
+    w.pod(ctrl); w.pod(mask); w.pod(status); w.pod(oamAddr);
+    w.pod(vramAddr); w.pod(tempAddr); w.pod(fineX); w.pod(writeToggle);
+    w.pod(dataBuffer);
+    w.pod(nmiOutput); w.pod(nmiRaised);
+    w.pod(ntByte); w.pod(atByte); w.pod(bgLo); w.pod(bgHi);
+    w.pod(bgShiftLo); w.pod(bgShiftHi); w.pod(atShiftLo); w.pod(atShiftHi);
+    w.pod(atLatchLo); w.pod(atLatchHi);
+    w.pod(spriteLine); w.pod(spriteRows); w.pod(spriteCount);
+    w.pod(sprite0OnLine); w.pod(sprite0Hit);
+}
+
+void PPU::loadState(StateReader& r) {
+    r.pod(vram); r.pod(palette); r.pod(oam);
+    r.pod(frameReady);
+    r.pod(scanline); r.pod(cycle); r.pod(oddFrame);
+    r.pod(ctrl); r.pod(mask); r.pod(status); r.pod(oamAddr);
+    colorMask = (mask & 0x01) ? 0x30 : 0x3F;
+    r.pod(vramAddr); r.pod(tempAddr); r.pod(fineX); r.pod(writeToggle);
+    r.pod(dataBuffer);
+    r.pod(nmiOutput); r.pod(nmiRaised);
+    r.pod(ntByte); r.pod(atByte); r.pod(bgLo); r.pod(bgHi);
+    bgPatternAddr = 0xFFFF;
+    r.pod(bgShiftLo); r.pod(bgShiftHi); r.pod(atShiftLo); r.pod(atShiftHi);
+    r.pod(atLatchLo); r.pod(atLatchHi);
+    r.pod(spriteLine); r.pod(spriteRows); r.pod(spriteCount);
+    r.pod(sprite0OnLine); r.pod(sprite0Hit);
+}
@@ -1,8 +1,10 @@
 #pragma once
 #include <cstdint>
 #include <array>
+#include "cartridge.h"
 
-class Cartridge;
+class StateWriter;
+class StateReader;
 
 class PPU {
 public:
@@ -17,8 +19,24 @@ public:
     // Clock one PPU cycle
     void clock();
 
-    // Framebuffer access
-    const uint32_t* getFrameBuffer() const { return frameBuffer.data(); }
+    // Clock `dots` cycles with no register access in between. Whole visible
+    // scanlines take a one-pass fast path; partial lines fall back to clock().
+    void run(int dots);
+
+    // Number of clock() calls up to and including the one that sets vblank,
+    // assuming no register writes in between
+    int dotsUntilVblank() const;
+
+    // Framebuffer access: 256x240 NES colour numbers (0-63) and each line's
+    // PPUMASK emphasis bits (0-7, as of the line's first pixel); expandFrame()
+    // in palette.h turns them into ARGB
+    const uint8_t* getFrameBuffer() const { return frameBuffer.data(); }
+    const uint8_t* getLineEmphasis() const { return lineEmphasis.data(); }
+
+    // With output off (run-ahead's hidden frames) the framebuffer is left
+    // alone and pixels are only composed as far as sprite 0 hit needs
+    void setOutputEnabled(bool on) { output = on; }
+    bool outputEnabled() const { return output; }
     bool isFrameReady() const { return frameReady; }
     void clearFrameReady() { frameReady = false; }
 
@@ -29,6 +47,11 @@ public:
     // OAM DMA
     uint8_t* getOAM() { return oam.data(); }
 
+    // Save states (layout in state.h). The framebuffer is output rather than
+    // state: it is fully redrawn before the next frame is ready.
+    void saveState(StateWriter& w) const;
+    void loadState(StateReader& r);
+
 private:
     Cartridge* cartridge = nullptr;
 
@@ -37,17 +60,21 @@ private:
     std::array<uint8_t, 32>   palette{};     // palette RAM
     std::array<uint8_t, 256>  oam{};         // OAM (sprite data)
 
-    // Framebuffer (256 x 240, ARGB)
-    std::array<uint32_t, 256 * 240> frameBuffer{};
+    // Framebuffer (256 x 240, palette indices)
+    std::array<uint8_t, 256 * 240> frameBuffer{};
+    std::array<uint8_t, 240> lineEmphasis{};
     bool frameReady = false;
+    bool output = true;
 
     // Scanline / cycle counters
     int scanline = -1;  // -1 = pre-render, 0-239 = visible, 241 = post/vblank
     int cycle = 0;
+    bool oddFrame = false; // odd frames skip the last pre-render dot
 
     // PPU registers
     uint8_t ctrl = 0;      // $2000 PPUCTRL
     uint8_t mask = 0;      // $2001 PPUMASK
+    uint8_t colorMask = 0x3F; // ANDed into every colour: 0x30 in grayscale mode
     uint8_t status = 0;    // $2002 PPUSTATUS
 
     uint8_t oamAddr = 0;   // $2003 OAMADDR
@@ -70,6 +97,7 @@ private:
     uint8_t  atByte = 0;
     uint8_t  bgLo = 0;
     uint8_t  bgHi = 0;
+    uint16_t bgPatternAddr = 0xFFFF; // row bgLo/bgHi came from; none after a restore
     uint16_t bgShiftLo = 0;
     uint16_t bgShiftHi = 0;
     uint16_t atShiftLo = 0;
@@ -85,8 +113,7 @@ private:
         uint8_t x;
     };
     std::array<Sprite, 8> spriteLine{};
-    std::array<uint8_t, 8> spriteShiftLo{};
-    std::array<uint8_t, 8> spriteShiftHi{};
+    std::array<uint16_t, 8> spriteRows{}; // decoded pattern rows, flip applied
     int spriteCount = 0;
     bool sprite0OnLine = false;
     bool sprite0Hit = false;
@@ -100,6 +127,12 @@ private:
 
     // Rendering helpers
     void renderPixel();
+    void renderScanline();
+    uint16_t fetchBackgroundTile();
+    const Cartridge::TileRow& patternRow(uint16_t addr) const;
+    uint16_t bgPatternAddress() const {
+        return ((ctrl & 0x10) ? 0x1000 : 0x0000) + ntByte * 16 + ((vramAddr >> 12) & 0x07);
+    }
     void loadBackgroundShifters();
     void updateShifters();
     void evaluateSprites();
@@ -108,7 +141,4 @@ private:
     void incrementY();
     void transferX();
     void transferY();
-
-    // NES palette -> ARGB
-    static uint32_t nesColor(uint8_t idx);
 };
@@ -0,0 +1,167 @@
+#include "rewind.h"
+#include <cstring>
+
+// dst = a ^ b, a word at a time
+static void xorInto(uint8_t* dst, const uint8_t* a, const uint8_t* b, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t x, y;
+        std::memcpy(&x, a + i, 8);
+        std::memcpy(&y, b + i, 8);
+        x ^= y;
+        std::memcpy(dst + i, &x, 8);
+    }
+    for (; i < size; i++) dst[i] = a[i] ^ b[i];
+}
+
+Rewind::Rewind(size_t budgetBytes, int keyframeInterval)
+    : budget(budgetBytes), interval(keyframeInterval < 1 ? 1 : keyframeInterval) {}
+
+void Rewind::push(std::span<const uint8_t> state) {
+    Entry entry;
+    entry.size = (uint32_t)state.size();
+    entry.keyframe = sinceKeyframe == 0 || sinceKeyframe >= interval ||
+                     keyframe.size() != state.size();
+
+    if (entry.keyframe) {
+        keyframe.assign(state.begin(), state.end());
+        encode(state.data(), state.size(), coded);
+        sinceKeyframe = 1;
+    } else {
+        scratch.resize(state.size());
+        xorInto(scratch.data(), state.data(), keyframe.data(), state.size());
+        encode(scratch.data(), scratch.size(), coded);
+        sinceKeyframe++;
+    }
+    entry.coded.assign(coded.begin(), coded.end()); // exact size, coded keeps its capacity
+
+    used += entry.coded.size();
+    history.push_back(std::move(entry));
+
+    // The newest keyframe and its deltas always stay
+    while (used > budget && history.size() > (size_t)sinceKeyframe) {
+        dropOldest();
+    }
+}
+
+bool Rewind::pop(std::vector<uint8_t>& state) {
+    if (history.empty()) return false;
+
+    Entry& entry = history.back();
+    state.resize(entry.size);
+    decode(entry.coded, state.data(), state.size());
+    if (!entry.keyframe) {
+        xorInto(state.data(), state.data(), keyframe.data(), state.size());
+    }
+
+    bool wasKeyframe = entry.keyframe;
+    used -= entry.coded.size();
+    history.pop_back();
+    if (wasKeyframe) {
+        restoreKeyframe();
+    } else {
+        sinceKeyframe--;
+    }
+    return true;
+}
+
+void Rewind::clear() {
+    history.clear();
+    keyframe.clear();
+    used = 0;
+    sinceKeyframe = 0;
+}
+
+void Rewind::dropOldest() {
+    // A keyframe takes its deltas with it
+    do {
+        used -= history.front().coded.size();
+        history.pop_front();
+    } while (!history.empty() && !history.front().keyframe);
+}
+
+// After the newest keyframe was popped: find the one before it
+void Rewind::restoreKeyframe() {
+    sinceKeyframe = 0;
+    for (auto it = history.rbegin(); it != history.rend(); ++it) {
+        sinceKeyframe++;
+        if (it->keyframe) {
+            keyframe.resize(it->size);
+            decode(it->coded, keyframe.data(), keyframe.size());
+            return;
+        }
+    }
+    clear();
+}
+
+// ===================== Run-length coding =====================
+
+static void putVarint(std::vector<uint8_t>& out, size_t value) {
+    while (value >= 0x80) {
+        out.push_back((uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((uint8_t)value);
+}
+
+static size_t getVarint(const uint8_t*& in) {
+    size_t value = 0;
+    int shift = 0;
+    uint8_t b;
+    do {
+        b = *in++;
+        value |= (size_t)(b & 0x7F) << shift;
+        shift += 7;
+    } while (b & 0x80);
+    return value;
+}
+
+void Rewind::encode(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    out.clear();
+    out.reserve(size + size / 64 + 16);
+    size_t i = 0;
+    while (i < size) {
+        // Zero run, eight bytes at a time where possible
+        size_t zeros = i;
+        while (zeros + 8 <= size) {
+            uint64_t word;
+            std::memcpy(&word, data + zeros, 8);
+            if (word) break;
+            zeros += 8;
+        }
+        while (zeros < size && data[zeros] == 0) zeros++;
+
+        // Literals until a zero run long enough to be worth a new token
+        size_t literals = zeros;
+        while (literals < size) {
+            if (data[literals] == 0) {
+                size_t run = literals;
+                while (run < size && run - literals < 4 && data[run] == 0) run++;
+                if (run - literals >= 4 || run == size) break;
+                literals = run;
+            } else {
+                literals++;
+            }
+        }
+
+        putVarint(out, zeros - i);
+        putVarint(out, literals - zeros);
+        out.insert(out.end(), data + zeros, data + literals);
+        i = literals;
+    }
+}
+
+void Rewind::decode(const std::vector<uint8_t>& coded, uint8_t* out, size_t size) {
+    const uint8_t* in = coded.data();
+    const uint8_t* end = in + coded.size();
+    size_t pos = 0;
+    while (in < end && pos < size) {
+        size_t zeros = getVarint(in);
+        size_t literals = getVarint(in);
+        std::memset(out + pos, 0, zeros);
+        pos += zeros;
+        std::memcpy(out + pos, in, literals);
+        in += literals;
+        pos += literals;
+    }
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <vector>
+
+// Frame history for rewinding. Push a save state (Bus::saveState) every
+// frame; pop hands them back newest first. Every `keyframeInterval` frames a
+// full snapshot is kept, the frames in between are stored as the XOR against
+// it, and everything is run-length coded, so frames that only touch a few
+// bytes of RAM cost a few bytes. Once the coded history outgrows the budget
+// the oldest keyframe and its deltas are dropped.
+class Rewind {
+public:
+    explicit Rewind(size_t budgetBytes = 32 << 20, int keyframeInterval = 60);
+
+    void push(std::span<const uint8_t> state);
+    bool pop(std::vector<uint8_t>& state); // false once the history is empty
+    void clear();
+
+    size_t frames() const { return history.size(); }
+    size_t bytesUsed() const { return used; }
+
+private:
+    struct Entry {
+        bool keyframe;
+        uint32_t size;              // decoded state size
+        std::vector<uint8_t> coded;
+    };
+    std::deque<Entry> history;
+    std::vector<uint8_t> keyframe; // decoded newest keyframe in the history
+    std::vector<uint8_t> scratch; // XOR delta
+    std::vector<uint8_t> coded;   // encoder output, reused between frames
+    size_t budget;
+    int interval;
+    size_t used = 0;
+    int sinceKeyframe = 0; // entries from the newest keyframe on, itself included
+
+    void dropOldest();
+    void restoreKeyframe();
+
+    // Zero runs and literal runs, each length as a LEB128 varint
+    static void encode(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+    static void decode(const std::vector<uint8_t>& coded, uint8_t* out, size_t size);
+};
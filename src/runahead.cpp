@@ -0,0 +1,36 @@
+#include "runahead.h"
+#include "console.h"
+#include <chrono>
+
+void RunAhead::runFrame() {
+    if (aheadFrames == 0) {
+        nes.runFrame();
+        return;
+    }
+
+    const bool picture = nes.ppu.outputEnabled();
+    const bool sound = nes.apu.outputEnabled();
+
+    // The real frame: heard, not seen
+    nes.ppu.setOutputEnabled(false);
+    nes.runFrame();
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+
+    state.resize(nes.bus.stateSize());
+    nes.bus.saveState(state);
+
+    nes.apu.setOutputEnabled(false);
+    for (int i = 0; i < aheadFrames; i++) {
+        nes.ppu.setOutputEnabled(picture && i == aheadFrames - 1);
+        nes.runFrame();
+    }
+    nes.apu.setOutputEnabled(sound);
+    nes.ppu.setOutputEnabled(picture);
+
+    nes.bus.loadState(state);
+
+    double perFrame = std::chrono::duration<double>(Clock::now() - start).count() / aheadFrames;
+    aheadCost = aheadCost == 0.0 ? perFrame : aheadCost * 0.95 + perFrame * 0.05;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class Console;
+
+// Run-ahead input-lag reduction. Each host frame the real timeline advances
+// one frame with sound but no picture and is saved; then `frames` more are
+// emulated with the same input, silent, drawing only the last one, and the
+// system is rolled back to the saved state. The picture therefore shows
+// where the game will be `frames` frames later, hiding that much of the
+// game's own input lag.
+class RunAhead {
+public:
+    explicit RunAhead(Console& nes) : nes(nes) {}
+
+    // Each frame ahead costs a whole emulated frame per host frame
+    static constexpr int MAX_FRAMES = 8;
+
+    void setFrames(int n) { aheadFrames = n < 0 ? 0 : n > MAX_FRAMES ? MAX_FRAMES : n; }
+    int frames() const { return aheadFrames; }
+
+    // One host frame. Set the controller input first. Picture and sound
+    // output stay as the caller set them; only the hidden frames are muted.
+    void runFrame();
+
+    // Host time per hidden frame, snapshot and rollback included (a running
+    // average; 0 until run-ahead has been used)
+    double secondsPerAheadFrame() const { return aheadCost; }
+
+private:
+    Console& nes;
+    int aheadFrames = 0;
+    std::vector<uint8_t> state;
+    double aheadCost = 0.0;
+};
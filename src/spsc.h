@@ -0,0 +1,54 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Wait-free single-producer/single-consumer ring. Each side owns one index
+// and only reads the other's, so neither ever blocks or retries; the indices
+// (and each side's cached copy of the other's) sit on separate cache lines so
+// the two threads don't bounce a line between them on every transfer.
+// Items move in bulk: one acquire/release pair per push() or pop() call.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // Producer: append up to `count` items; returns how many fit
+    size_t push(const T* items, size_t count) {
+        size_t head = writeIndex.load(std::memory_order_relaxed);
+        if (Capacity - (head - cachedRead) < count) {
+            cachedRead = readIndex.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(count, Capacity - (head - cachedRead));
+        for (size_t i = 0; i < n; i++) buffer[(head + i) & (Capacity - 1)] = items[i];
+        writeIndex.store(head + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: take up to `count` items; returns how many were available
+    size_t pop(T* out, size_t count) {
+        size_t tail = readIndex.load(std::memory_order_relaxed);
+        if (cachedWrite - tail < count) {
+            cachedWrite = writeIndex.load(std::memory_order_acquire);
+        }
+        size_t n = std::min(count, cachedWrite - tail);
+        for (size_t i = 0; i < n; i++) out[i] = buffer[(tail + i) & (Capacity - 1)];
+        readIndex.store(tail + n, std::memory_order_release);
+        return n;
+    }
+
+    // Items queued, as seen from either side (exact only when the other is idle)
+    size_t size() const {
+        return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire);
+    }
+    static constexpr size_t capacity() { return Capacity; }
+
+private:
+    alignas(64) std::atomic<size_t> writeIndex{0}; // producer's
+    size_t cachedRead = 0;                         // producer's view of readIndex
+    alignas(64) std::atomic<size_t> readIndex{0};  // consumer's
+    size_t cachedWrite = 0;                        // consumer's view of writeIndex
+    alignas(64) std::array<T, Capacity> buffer{};
+};
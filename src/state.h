@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <type_traits>
+
+// Save states are a flat byte stream: a small header, then each component's
+// fields copied raw in a fixed order. Any change to what a component writes
+// needs a STATE_VERSION bump.
+constexpr uint32_t STATE_MAGIC = 0x5353454E; // "NESS"
+constexpr uint32_t STATE_VERSION = 3;
+
+struct StateHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size; // whole snapshot, header included
+};
+
+class StateWriter {
+public:
+    StateWriter() = default; // measures only
+    explicit StateWriter(std::span<uint8_t> out) : data(out.data()), capacity(out.size()) {}
+
+    template <typename T>
+    void pod(const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes(&value, sizeof(T));
+    }
+    void bytes(const void* src, size_t n) {
+        if (data && pos + n <= capacity) std::memcpy(data + pos, src, n);
+        pos += n;
+    }
+
+    size_t size() const { return pos; }
+    bool ok() const { return !data || pos <= capacity; }
+
+private:
+    uint8_t* data = nullptr;
+    size_t capacity = 0;
+    size_t pos = 0;
+};
+
+class StateReader {
+public:
+    explicit StateReader(std::span<const uint8_t> in) : data(in.data()), size(in.size()) {}
+
+    template <typename T>
+    void pod(T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes(&value, sizeof(T));
+    }
+    void bytes(void* dst, size_t n) {
+        if (pos + n <= size) std::memcpy(dst, data + pos, n);
+        pos += n;
+    }
+
+    bool ok() const { return pos <= size; }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t pos = 0;
+};
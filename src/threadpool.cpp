@@ -0,0 +1,63 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+    threadCount = threads < 1 ? 1 : threads;
+    slices = std::make_unique<Slice[]>(threadCount);
+    for (int id = 1; id < threadCount; id++) {
+        workers.emplace_back([this, id] { workerLoop(id); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    quit.store(true);
+    generation.fetch_add(1, std::memory_order_release);
+    generation.notify_all();
+    for (std::thread& t : workers) t.join();
+}
+
+void ThreadPool::run(size_t count, void (*fn)(void*, size_t), void* ctx) {
+    for (int id = 0; id < threadCount; id++) {
+        slices[id].next.store(count * id / threadCount, std::memory_order_relaxed);
+        slices[id].end = count * (id + 1) / threadCount;
+    }
+    job = fn;
+    jobCtx = ctx;
+
+    // Everything above is published by the generation bump, and everything
+    // the workers did comes back through busy
+    busy.store(threadCount - 1, std::memory_order_relaxed);
+    generation.fetch_add(1, std::memory_order_release);
+    generation.notify_all();
+
+    runSlices(0);
+
+    int left;
+    while ((left = busy.load(std::memory_order_acquire)) != 0) {
+        busy.wait(left, std::memory_order_acquire);
+    }
+}
+
+void ThreadPool::workerLoop(int id) {
+    uint32_t seen = 0;
+    for (;;) {
+        generation.wait(seen, std::memory_order_acquire);
+        seen = generation.load(std::memory_order_acquire);
+        if (quit.load()) return;
+
+        runSlices(id);
+        if (busy.fetch_sub(1, std::memory_order_acq_rel) == 1) busy.notify_one();
+    }
+}
+
+void ThreadPool::runSlices(int id) {
+    // Own slice first, then the others' leftovers, one index at a time
+    for (int k = 0; k < threadCount; k++) {
+        Slice& slice = slices[(id + k) % threadCount];
+        for (;;) {
+            size_t i = slice.next.fetch_add(1, std::memory_order_relaxed);
+            if (i >= slice.end) break;
+            job(jobCtx, i);
+        }
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads for data-parallel loops. parallelFor() gives
+// every thread (the caller is thread 0) an even slice of the index range; a
+// thread that runs out of work steals single indices from the others' slices,
+// so uneven items still balance. Dispatch, stealing and completion are all
+// atomics (C++20 wait/notify), never a mutex.
+class ThreadPool {
+public:
+    explicit ThreadPool(int threads = 0); // 0 = one per hardware thread
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int threads() const { return threadCount; }
+
+    // fn(i) for every i in [0, count), each exactly once; returns when all
+    // have finished. One parallelFor at a time. fn is called in place, not
+    // copied, so dispatch never allocates.
+    template <typename Fn>
+    void parallelFor(size_t count, Fn&& fn) {
+        run(count, [](void* ctx, size_t i) { (*static_cast<std::remove_reference_t<Fn>*>(ctx))(i); },
+            const_cast<void*>(static_cast<const void*>(&fn)));
+    }
+
+private:
+    struct alignas(64) Slice {
+        std::atomic<size_t> next{0};
+        size_t end = 0;
+    };
+    int threadCount;
+    std::unique_ptr<Slice[]> slices;
+    std::vector<std::thread> workers;
+
+    void (*job)(void* ctx, size_t i) = nullptr;
+    void* jobCtx = nullptr;
+    std::atomic<uint32_t> generation{0}; // bumped to start a job (or to quit)
+    std::atomic<int> busy{0};            // workers still on the current job
+    std::atomic<bool> quit{false};
+
+    void run(size_t count, void (*fn)(void*, size_t), void* ctx);
+    void workerLoop(int id);
+    void runSlices(int id);
+};
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Lock-free triple buffer: one producer hands whole values (frames) to one
+// consumer, and neither ever waits for the other. The producer fills back(),
+// publish() swaps it with the shared middle slot; the consumer's acquire()
+// swaps the middle slot with front() when something new is there. A frame
+// published before the previous one was picked up replaces it, which is
+// counted as dropped.
+template <typename T>
+class TripleBuffer {
+public:
+    // Producer
+    T& back() { return slots[backIndex]; }
+    void publish() {
+        uint8_t previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+        if (previous & FRESH) dropped.fetch_add(1, std::memory_order_relaxed);
+        backIndex = previous & INDEX;
+    }
+
+    // Consumer: make the newest published value front(); false (and front()
+    // unchanged) if nothing was published since the last call
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+        frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+    const T& front() const { return slots[frontIndex]; }
+
+    // Values overwritten unseen, readable from any thread
+    uint64_t droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint8_t INDEX = 0x03;
+    static constexpr uint8_t FRESH = 0x04;
+
+    std::array<T, 3> slots{};
+    alignas(64) std::atomic<uint8_t> middle{1};
+    std::atomic<uint64_t> dropped{0};
+    alignas(64) uint8_t backIndex = 0;  // producer's
+    alignas(64) uint8_t frontIndex = 2; // consumer's
+};
@@ -0,0 +1,572 @@
+#include "upscale.h"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr int W = Upscaler::WIDTH;
+constexpr int H = Upscaler::HEIGHT;
+constexpr int PAD = 2;                 // xBRZ's 4x4 kernel reaches two pixels right and down
+constexpr int STRIDE = W + 2 * PAD;
+constexpr int ROWS = H + 2 * PAD;
+constexpr int LINES_PER_BAND = 16;
+
+// HQx: a neighbour differs when any YUV component is off by more than this
+constexpr float HQ_LUMA = 48.0f, HQ_U = 7.0f, HQ_V = 6.0f;
+
+// xBRZ's default configuration. Per pixel, distances are compared squared.
+constexpr float EQUAL_COLOR_TOLERANCE = 30.0f;
+constexpr float CENTER_DIRECTION_BIAS = 4.0f;
+constexpr float DOMINANT_DIRECTION_THRESHOLD = 3.6f;
+constexpr float STEEP_DIRECTION_THRESHOLD = 2.2f;
+
+// Blend level of a corner. A pixel's four packed into a byte: top-left in
+// bits 0-1, then top-right, bottom-right and bottom-left.
+enum : uint8_t { BLEND_NONE = 0, BLEND_NORMAL = 1, BLEND_DOMINANT = 2 };
+uint8_t bottomRight(uint8_t b) { return (b >> 4) & 3; }
+uint8_t topRight(uint8_t b) { return (b >> 2) & 3; }
+uint8_t bottomLeft(uint8_t b) { return b >> 6; }
+
+// A pixel's 3x3 neighbourhood, numbered
+//   0 1 2
+//   3 4 5
+//   6 7 8
+// Index i of the view turned clockwise by `rot` quarter turns is turn[rot][i]
+// of the original, so every rule is written for one corner only.
+constexpr int turn[4][9] = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8 },
+    { 6, 3, 0, 7, 4, 1, 8, 5, 2 },
+    { 8, 7, 6, 5, 4, 3, 2, 1, 0 },
+    { 2, 5, 8, 1, 4, 7, 0, 3, 6 },
+};
+
+struct Neighbourhood {
+    uint32_t color[9];
+    float luma[9], chromaB[9], chromaR[9];
+
+    float distance2(int a, int b) const {
+        float dy = luma[a] - luma[b], db = chromaB[a] - chromaB[b], dr = chromaR[a] - chromaR[b];
+        return dy * dy + db * db + dr * dr;
+    }
+    bool differs(int a, int b) const { // HQx
+        return std::abs(luma[a] - luma[b]) > HQ_LUMA || std::abs(chromaB[a] - chromaB[b]) > HQ_U ||
+               std::abs(chromaR[a] - chromaR[b]) > HQ_V;
+    }
+};
+
+// Output block of one source pixel, addressed in the turned view
+struct Block {
+    uint32_t* out;
+    int stride;
+    int size;
+    int rot;
+
+    uint32_t& at(int i, int j) const { // row i, column j
+        switch (rot) {
+        case 1:  return out[(size - 1 - j) * stride + i];
+        case 2:  return out[(size - 1 - i) * stride + size - 1 - j];
+        case 3:  return out[j * stride + size - 1 - i];
+        default: return out[i * stride + j];
+        }
+    }
+};
+
+// Weighted average of ARGB colours, the weights summing to a power of two
+// of at most 256. Two channels at a time, 16 bits apart.
+uint32_t mix(uint32_t a, unsigned wa, uint32_t b, unsigned wb, uint32_t c = 0, unsigned wc = 0) {
+    int shift = std::countr_zero(wa + wb + wc);
+    uint32_t rb = ((a & 0xFF00FF) * wa + (b & 0xFF00FF) * wb + (c & 0xFF00FF) * wc) >> shift;
+    uint32_t ag = ((a >> 8 & 0xFF00FF) * wa + (b >> 8 & 0xFF00FF) * wb + (c >> 8 & 0xFF00FF) * wc) >> shift;
+    return (rb & 0xFF00FF) | (ag & 0xFF00FF) << 8;
+}
+
+// Move output pixel (i, j) m/n of the way to `color`, in 1/256 steps
+void blend(const Block& block, int i, int j, uint32_t color, unsigned m, unsigned n) {
+    unsigned w = (m * 256 + n / 2) / n;
+    uint32_t& px = block.at(i, j);
+    px = mix(px, 256 - w, color, w);
+}
+
+// std::sqrt may set errno, which keeps the compiler from vectorizing it
+void sqrtRow(float* v, int n) {
+    int x = 0;
+#if defined(__SSE2__)
+    for (; x + 4 <= n; x += 4) _mm_storeu_ps(v + x, _mm_sqrt_ps(_mm_loadu_ps(v + x)));
+#endif
+    for (; x < n; x++) v[x] = std::sqrt(v[x]);
+}
+
+// ---------- HQx ----------
+
+// hqx's case for the top-left output pixel, by the pattern of neighbours
+// that differ from the pixel: bit 0 for the top-left one (w1 in hqx) through
+// bit 7 for the bottom-right (w9), skipping the pixel itself. Names follow
+// hq2x's PIXEL00_* blends; with two, the first applies if the neighbours the
+// case compares differ. The other corners look up the pattern of the turned
+// view, which gives hqx's cases for them too.
+enum HqRule : uint8_t {
+    HQ_20, HQ_21, HQ_22, HQ_11, HQ_12, HQ_10,
+    HQ_10_20, HQ_0_20, HQ_10_70, HQ_0_100, HQ_10_90, HQ_0_90, // up and left compared
+    HQ_11_60,                                                 // up and right
+    HQ_12_61,                                                 // down and left
+};
+
+constexpr HqRule hqRules[256] = {
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 0-7
+    HQ_21,    HQ_12,    HQ_10_20, HQ_0_20,  HQ_21,    HQ_12,    HQ_10_90, HQ_0_90, // 8-15
+    HQ_20,    HQ_20,    HQ_22,    HQ_11_60, HQ_20,    HQ_20,    HQ_22,    HQ_11_60, // 16-23
+    HQ_21,    HQ_12,    HQ_0_20,  HQ_0_20,  HQ_21,    HQ_12,    HQ_10,    HQ_0_20, // 24-31
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 32-39
+    HQ_21,    HQ_12,    HQ_10_90, HQ_0_90,  HQ_21,    HQ_12,    HQ_10_70, HQ_0_100, // 40-47
+    HQ_20,    HQ_20,    HQ_22,    HQ_11_60, HQ_20,    HQ_20,    HQ_22,    HQ_11_60, // 48-55
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10,    HQ_0_100, // 56-63
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 64-71
+    HQ_21,    HQ_12_61, HQ_0_20,  HQ_0_20,  HQ_21,    HQ_12_61, HQ_10_70, HQ_0_20, // 72-79
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 80-87
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10_70, HQ_0_20, // 88-95
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 96-103
+    HQ_21,    HQ_12_61, HQ_10,    HQ_0_20,  HQ_21,    HQ_12_61, HQ_10,    HQ_0_100, // 104-111
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11_60, // 112-119
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12_61, HQ_10,    HQ_0_100, // 120-127
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 128-135
+    HQ_21,    HQ_12,    HQ_10_20, HQ_0_20,  HQ_21,    HQ_12,    HQ_10_90, HQ_0_90, // 136-143
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 144-151
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10_70, HQ_0_20, // 152-159
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 160-167
+    HQ_21,    HQ_12,    HQ_10_90, HQ_0_90,  HQ_21,    HQ_12,    HQ_10_70, HQ_0_100, // 168-175
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 176-183
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_90,  HQ_21,    HQ_12,    HQ_10,    HQ_0_100, // 184-191
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 192-199
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10_70, HQ_0_90, // 200-207
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 208-215
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10,    HQ_0_20, // 216-223
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 224-231
+    HQ_21,    HQ_12,    HQ_10_70, HQ_0_20,  HQ_21,    HQ_12,    HQ_10,    HQ_0_100, // 232-239
+    HQ_20,    HQ_20,    HQ_22,    HQ_11,    HQ_20,    HQ_20,    HQ_22,    HQ_11, // 240-247
+    HQ_21,    HQ_12,    HQ_10,    HQ_0_20,  HQ_21,    HQ_12,    HQ_10,    HQ_0_100, // 248-255
+};
+
+// The turned view's pattern, in hqx's bit order
+unsigned hqPattern(unsigned differ, const int* t) {
+    constexpr int neighbours[8] = { 0, 1, 2, 3, 5, 6, 7, 8 };
+    unsigned pattern = 0;
+    for (int k = 0; k < 8; k++) pattern |= (differ >> t[neighbours[k]] & 1) << k;
+    return pattern;
+}
+
+// hq2x's top-left pixel in the turned view
+uint32_t hq2xCorner(const Neighbourhood& nb, const int* t, HqRule rule) {
+    uint32_t e = nb.color[4], corner = nb.color[t[0]], up = nb.color[t[1]], left = nb.color[t[3]];
+    bool cross = nb.differs(t[1], t[3]);
+    switch (rule) {
+    case HQ_20:    return mix(e, 2, left, 1, up, 1);
+    case HQ_21:    return mix(e, 2, corner, 1, up, 1);
+    case HQ_22:    return mix(e, 2, corner, 1, left, 1);
+    case HQ_11:    return mix(e, 3, left, 1);
+    case HQ_12:    return mix(e, 3, up, 1);
+    case HQ_10:    return mix(e, 3, corner, 1);
+    case HQ_10_20: return cross ? mix(e, 3, corner, 1) : mix(e, 2, left, 1, up, 1);
+    case HQ_0_20:  return cross ? e : mix(e, 2, left, 1, up, 1);
+    case HQ_10_70: return cross ? mix(e, 3, corner, 1) : mix(e, 6, left, 1, up, 1);
+    case HQ_0_100: return cross ? e : mix(e, 14, left, 1, up, 1);
+    case HQ_10_90: return cross ? mix(e, 3, corner, 1) : mix(e, 2, left, 3, up, 3);
+    case HQ_0_90:  return cross ? e : mix(e, 2, left, 3, up, 3);
+    case HQ_11_60: return nb.differs(t[1], t[5]) ? mix(e, 3, left, 1) : mix(e, 5, up, 2, left, 1);
+    default:       return nb.differs(t[7], t[3]) ? mix(e, 3, up, 1) : mix(e, 5, left, 2, up, 1);
+    }
+}
+
+// hq3x's top-left pixel: hq3x decides each case as hq2x does, with its own
+// blends
+uint32_t hq3xCorner(const Neighbourhood& nb, const int* t, HqRule rule) {
+    uint32_t e = nb.color[4], corner = nb.color[t[0]], up = nb.color[t[1]], left = nb.color[t[3]];
+    bool cross = nb.differs(t[1], t[3]);
+    switch (rule) {
+    case HQ_20:    return mix(e, 2, left, 1, up, 1);
+    case HQ_11:    return mix(e, 3, left, 1);
+    case HQ_12:    return mix(e, 3, up, 1);
+    case HQ_21:
+    case HQ_22:
+    case HQ_10:    return mix(e, 3, corner, 1);
+    case HQ_10_20: return cross ? mix(e, 3, corner, 1) : mix(e, 2, left, 7, up, 7);
+    case HQ_0_20:  return cross ? e : mix(e, 2, left, 7, up, 7);
+    case HQ_10_70: return cross ? mix(e, 3, corner, 1) : mix(e, 2, left, 1, up, 1);
+    case HQ_0_100: return cross ? e : mix(e, 2, left, 1, up, 1);
+    case HQ_10_90: return cross ? mix(e, 3, corner, 1) : mix(left, 1, up, 1);
+    case HQ_0_90:  return cross ? e : mix(left, 1, up, 1);
+    case HQ_11_60: return nb.differs(t[1], t[5]) ? mix(e, 3, left, 1) : mix(e, 2, left, 1, up, 1);
+    default:       return nb.differs(t[7], t[3]) ? mix(e, 3, up, 1) : mix(e, 2, left, 1, up, 1);
+    }
+}
+
+// hq3x's top middle pixel, from the cases of the corners beside it
+uint32_t hq3xEdge(const Neighbourhood& nb, const int* t, unsigned differ, HqRule left, HqRule right) {
+    uint32_t e = nb.color[4], up = nb.color[t[1]];
+    if (!(differ >> t[1] & 1)) return mix(e, 3, up, 1);
+
+    // A line cutting one corner (the 90 cases) passes over this pixel; more
+    // so when the other corner carries it on at a shallow angle (60 and 61)
+    if (left == HQ_10_90 || left == HQ_0_90) {
+        if (nb.differs(t[1], t[3])) return e;
+        return right == HQ_12_61 ? mix(up, 3, e, 1) : mix(e, 3, up, 1);
+    }
+    if (right == HQ_10_90 || right == HQ_0_90) {
+        if (nb.differs(t[1], t[5])) return e;
+        return left == HQ_11_60 ? mix(up, 3, e, 1) : mix(e, 3, up, 1);
+    }
+
+    // Follows a corner blended across its diagonal (the 20 cases), unless
+    // both are
+    bool crossLeft = left == HQ_10_20 || left == HQ_0_20;
+    bool crossRight = right == HQ_10_20 || right == HQ_0_20;
+    if (crossLeft == crossRight) return e;
+    return nb.differs(t[1], crossLeft ? t[3] : t[5]) ? e : mix(e, 7, up, 1);
+}
+
+// ---------- xBRZ ----------
+
+template <int S>
+void xbrzLineShallow(const Block& b, uint32_t c) {
+    if constexpr (S == 2) {
+        blend(b, 1, 0, c, 1, 4); blend(b, 1, 1, c, 3, 4);
+    } else if constexpr (S == 3) {
+        blend(b, 2, 0, c, 1, 4); blend(b, 1, 2, c, 1, 4); blend(b, 2, 1, c, 3, 4);
+        b.at(2, 2) = c;
+    } else {
+        blend(b, 3, 0, c, 1, 4); blend(b, 2, 2, c, 1, 4); blend(b, 3, 1, c, 3, 4); blend(b, 2, 3, c, 3, 4);
+        b.at(3, 2) = c; b.at(3, 3) = c;
+    }
+}
+
+template <int S>
+void xbrzLineSteep(const Block& b, uint32_t c) {
+    if constexpr (S == 2) {
+        blend(b, 0, 1, c, 1, 4); blend(b, 1, 1, c, 3, 4);
+    } else if constexpr (S == 3) {
+        blend(b, 0, 2, c, 1, 4); blend(b, 2, 1, c, 1, 4); blend(b, 1, 2, c, 3, 4);
+        b.at(2, 2) = c;
+    } else {
+        blend(b, 0, 3, c, 1, 4); blend(b, 2, 2, c, 1, 4); blend(b, 1, 3, c, 3, 4); blend(b, 3, 2, c, 3, 4);
+        b.at(2, 3) = c; b.at(3, 3) = c;
+    }
+}
+
+template <int S>
+void xbrzLineSteepAndShallow(const Block& b, uint32_t c) {
+    if constexpr (S == 2) {
+        blend(b, 1, 0, c, 1, 4); blend(b, 0, 1, c, 1, 4); blend(b, 1, 1, c, 5, 6);
+    } else if constexpr (S == 3) {
+        blend(b, 2, 0, c, 1, 4); blend(b, 0, 2, c, 1, 4); blend(b, 2, 1, c, 3, 4); blend(b, 1, 2, c, 3, 4);
+        b.at(2, 2) = c;
+    } else {
+        blend(b, 3, 1, c, 3, 4); blend(b, 1, 3, c, 3, 4); blend(b, 3, 0, c, 1, 4); blend(b, 0, 3, c, 1, 4);
+        blend(b, 2, 2, c, 1, 3);
+        b.at(3, 3) = c; b.at(3, 2) = c; b.at(2, 3) = c;
+    }
+}
+
+template <int S>
+void xbrzLineDiagonal(const Block& b, uint32_t c) {
+    if constexpr (S == 2) {
+        blend(b, 1, 1, c, 1, 2);
+    } else if constexpr (S == 3) {
+        blend(b, 1, 2, c, 1, 8); blend(b, 2, 1, c, 1, 8); blend(b, 2, 2, c, 7, 8);
+    } else {
+        blend(b, 3, 2, c, 1, 2); blend(b, 2, 3, c, 1, 2);
+        b.at(3, 3) = c;
+    }
+}
+
+template <int S>
+void xbrzCorner(const Block& b, uint32_t c) {
+    // The area of a quarter circle cut off the block's corner
+    if constexpr (S == 2) {
+        blend(b, 1, 1, c, 21, 100);
+    } else if constexpr (S == 3) {
+        blend(b, 2, 2, c, 45, 100);
+    } else {
+        blend(b, 3, 3, c, 68, 100); blend(b, 3, 2, c, 9, 100); blend(b, 2, 3, c, 9, 100);
+    }
+}
+
+// Blend the bottom right corner of the turned view, if classified so
+template <int S>
+void xbrzBlend(const Neighbourhood& nb, const Block& block, uint8_t blendInfo) {
+    const int* t = turn[block.rot];
+    // Turn the packed corners along with the view
+    uint8_t info = (uint8_t)((blendInfo << (2 * block.rot)) | (blendInfo >> (8 - 2 * block.rot)));
+    if (bottomRight(info) < BLEND_NORMAL) return;
+
+    const int b = t[1], c = t[2], d = t[3], e = t[4], f = t[5], g = t[6], h = t[7], i = t[8];
+    auto eq = [&](int p, int q) { return nb.distance2(p, q) < EQUAL_COLOR_TOLERANCE * EQUAL_COLOR_TOLERANCE; };
+    auto color = [&](int p) { return nb.color[p]; };
+
+    bool lineBlend = bottomRight(info) >= BLEND_DOMINANT ||
+        // Not when a neighbouring corner blends too (isolated pixels), nor
+        // for L-shapes, where only the corner is rounded
+        (!(topRight(info) != BLEND_NONE && !eq(e, g)) &&
+         !(bottomLeft(info) != BLEND_NONE && !eq(e, c)) &&
+         !(!eq(e, i) && eq(g, h) && eq(h, i) && eq(i, f) && eq(f, c)));
+
+    uint32_t px = nb.distance2(e, f) <= nb.distance2(e, h) ? color(f) : color(h);
+    if (!lineBlend) {
+        xbrzCorner<S>(block, px);
+        return;
+    }
+
+    const float steep2 = STEEP_DIRECTION_THRESHOLD * STEEP_DIRECTION_THRESHOLD;
+    float fg = nb.distance2(f, g), hc = nb.distance2(h, c);
+    bool shallow = steep2 * fg <= hc && color(e) != color(g) && color(d) != color(g);
+    bool steep = steep2 * hc <= fg && color(e) != color(c) && color(b) != color(c);
+    if (shallow && steep) xbrzLineSteepAndShallow<S>(block, px);
+    else if (shallow) xbrzLineShallow<S>(block, px);
+    else if (steep) xbrzLineSteep<S>(block, px);
+    else xbrzLineDiagonal<S>(block, px);
+}
+
+} // namespace
+
+Upscaler::Upscaler(Filter filter, int threads)
+    : filter(filter), pool(threads),
+      pixels((size_t)STRIDE * ROWS), luma(pixels.size()), chromaB(pixels.size()), chromaR(pixels.size()) {
+    switch (filter) {
+    case Filter::Hq2x:  factor = 2; break;
+    case Filter::Hq3x:  factor = 3; break;
+    case Filter::Xbrz2: factor = 2; break;
+    case Filter::Xbrz3: factor = 3; break;
+    case Filter::Xbrz4: factor = 4; break;
+    }
+
+    if (filter != Filter::Hq2x && filter != Filter::Hq3x) {
+        // YCbCr with BT.2020 weights, as xBRZ's distance uses
+        const float kr = 0.2627f, kb = 0.0593f, kg = 1.0f - kr - kb;
+        const float sb = 0.5f / (1.0f - kb), sr = 0.5f / (1.0f - kr);
+        const float y[3] = { kr, kg, kb };
+        const float cb[3] = { -sb * kr, -sb * kg, sb * (1.0f - kb) };
+        const float cr[3] = { sr * (1.0f - kr), -sr * kg, -sr * kb };
+        std::copy_n(y, 3, toLuma); std::copy_n(cb, 3, toChromaB); std::copy_n(cr, 3, toChromaR);
+        corners.resize((size_t)(W + 1) * (H + 1));
+    }
+}
+
+bool Upscaler::parse(const std::string& name, Filter& filter) {
+    if (name == "hq2x") filter = Filter::Hq2x;
+    else if (name == "hq3x") filter = Filter::Hq3x;
+    else if (name == "xbrz2") filter = Filter::Xbrz2;
+    else if (name == "xbrz3") filter = Filter::Xbrz3;
+    else if (name == "xbrz4") filter = Filter::Xbrz4;
+    else return false;
+    return true;
+}
+
+void Upscaler::preparePlanes(const uint32_t* in, int row) {
+    const uint32_t* src = in + std::clamp(row - PAD, 0, H - 1) * W;
+    uint32_t* dst = pixels.data() + (size_t)row * STRIDE;
+    std::fill_n(dst, PAD, src[0]);
+    std::copy_n(src, W, dst + PAD);
+    std::fill_n(dst + PAD + W, PAD, src[W - 1]);
+
+    float* y = luma.data() + (size_t)row * STRIDE;
+    float* b = chromaB.data() + (size_t)row * STRIDE;
+    float* r = chromaR.data() + (size_t)row * STRIDE;
+    if (filter == Filter::Hq2x || filter == Filter::Hq3x) {
+        // YUV as hqx's lookup table has it: double precision, truncated to
+        // integers (the +128 offsets cancel in differences)
+        for (int x = 0; x < STRIDE; x++) {
+            double cr = (dst[x] >> 16) & 0xFF, cg = (dst[x] >> 8) & 0xFF, cb = dst[x] & 0xFF;
+            y[x] = (float)(int)(0.299 * cr + 0.587 * cg + 0.114 * cb);
+            b[x] = (float)(int)(-0.169 * cr - 0.331 * cg + 0.5 * cb);
+            r[x] = (float)(int)(0.5 * cr - 0.419 * cg - 0.081 * cb);
+        }
+        return;
+    }
+    for (int x = 0; x < STRIDE; x++) {
+        float cr = (float)((dst[x] >> 16) & 0xFF), cg = (float)((dst[x] >> 8) & 0xFF), cb = (float)(dst[x] & 0xFF);
+        y[x] = toLuma[0] * cr + toLuma[1] * cg + toLuma[2] * cb;
+        b[x] = toChromaB[0] * cr + toChromaB[1] * cg + toChromaB[2] * cb;
+        r[x] = toChromaR[0] * cr + toChromaR[1] * cg + toChromaR[2] * cb;
+    }
+}
+
+void Upscaler::classifyCorners(int begin, int end) {
+    // 2x2 blocks with top-left pixel (x, y), x and y from -1; the gradient
+    // along each diagonal is a sum of distances between diagonal neighbours,
+    // main (\) and anti (/), on the three pixel rows around the block.
+    // Distance row d (between pixel rows d and d + 1, d from -2) is kept in
+    // slot (d + 3) % 3, so each is computed once per band.
+    constexpr int N = W + 3; // x from -2 to W
+    float main[3][N], anti[3][N];
+    for (int d = begin - 2; d < end; d++) {
+        size_t top = (size_t)(d + PAD) * STRIDE, bottom = top + STRIDE;
+        const float* ly = luma.data(); const float* lb = chromaB.data(); const float* lr = chromaR.data();
+        float* m = main[(d + 3) % 3];
+        float* a = anti[(d + 3) % 3];
+        for (int x = 0; x < N; x++) {
+            size_t p = top + x, q = bottom + x + 1;     // (x, d) - (x + 1, d + 1)
+            float dy = ly[p] - ly[q], db = lb[p] - lb[q], dr = lr[p] - lr[q];
+            m[x] = dy * dy + db * db + dr * dr;
+            p = top + x + 1; q = bottom + x;            // (x + 1, d) - (x, d + 1)
+            dy = ly[p] - ly[q]; db = lb[p] - lb[q]; dr = lr[p] - lr[q];
+            a[x] = dy * dy + db * db + dr * dr;
+        }
+        sqrtRow(m, N);
+        sqrtRow(a, N);
+        if (d >= begin) classifyRow(d, main[(d + 1) % 3], main[(d + 2) % 3], main[d % 3],
+                                    anti[(d + 1) % 3], anti[(d + 2) % 3], anti[d % 3]);
+    }
+}
+
+void Upscaler::classifyRow(int row, const float* main0, const float* main1, const float* main2,
+                           const float* anti0, const float* anti1, const float* anti2) {
+    const int y = row - 1;
+    float acrossMain[W + 1], acrossAnti[W + 1];
+    for (int k = 0; k <= W; k++) {
+        // Block k has x = k - 1, index k + 1 in the rows above
+        acrossAnti[k] = anti1[k] + anti0[k + 1] + anti2[k + 1] + anti1[k + 2] +
+                        CENTER_DIRECTION_BIAS * anti1[k + 1];
+        acrossMain[k] = main1[k] + main0[k + 1] + main2[k + 1] + main1[k + 2] +
+                        CENTER_DIRECTION_BIAS * main1[k + 1];
+    }
+
+    // Per block: blend levels of f (top left), g (top right), j (bottom
+    // left) and k (bottom right) at bits 0, 2, 4 and 6
+    const uint32_t* top = pixels.data() + (size_t)(y + PAD) * STRIDE + PAD - 1;
+    const uint32_t* bottom = top + STRIDE;
+    uint8_t* out = corners.data() + (size_t)row * (W + 1);
+    for (int k = 0; k <= W; k++) {
+        uint32_t f = top[k], g = top[k + 1], j = bottom[k], kk = bottom[k + 1];
+        uint8_t blendInfo = 0;
+        if (!((f == g && j == kk) || (f == j && g == kk))) {
+            float jg = acrossAnti[k], fk = acrossMain[k];
+            if (jg < fk) {
+                // The block's anti-diagonal is the edge: round f and k off
+                uint8_t level = DOMINANT_DIRECTION_THRESHOLD * jg < fk ? BLEND_DOMINANT : BLEND_NORMAL;
+                if (f != g && f != j) blendInfo |= level;
+                if (kk != j && kk != g) blendInfo |= level << 6;
+            } else if (fk < jg) {
+                uint8_t level = DOMINANT_DIRECTION_THRESHOLD * fk < jg ? BLEND_DOMINANT : BLEND_NORMAL;
+                if (j != f && j != kk) blendInfo |= level << 4;
+                if (g != f && g != kk) blendInfo |= level << 2;
+            }
+        }
+        out[k] = blendInfo;
+    }
+}
+
+void Upscaler::scaleHq(int row, uint32_t* out) const {
+    const int s = factor, outStride = W * s;
+    const size_t centre = (size_t)(row + PAD) * STRIDE + PAD;
+    const int offsets[9] = { -STRIDE - 1, -STRIDE, -STRIDE + 1, -1, 0, 1, STRIDE - 1, STRIDE, STRIDE + 1 };
+
+    // Bit n: neighbour n differs from the pixel. Bit 4: a side neighbour is
+    // not exactly the pixel's colour, so even alike ones get blended in.
+    uint16_t differ[W] = {};
+    for (int n = 0; n < 9; n++) {
+        if (n == 4) continue;
+        const float* y = luma.data() + centre; const float* u = chromaB.data() + centre;
+        const float* v = chromaR.data() + centre;
+        const uint32_t* c = pixels.data() + centre;
+        const int o = offsets[n];
+        for (int x = 0; x < W; x++) {
+            bool d = (std::abs(y[x] - y[x + o]) > HQ_LUMA) | (std::abs(u[x] - u[x + o]) > HQ_U) |
+                     (std::abs(v[x] - v[x + o]) > HQ_V);
+            differ[x] |= (uint16_t)(d << n);
+            if (n & 1) differ[x] |= (uint16_t)((c[x] != c[x + o]) << 4);
+        }
+    }
+
+    uint32_t* dst = out + (size_t)row * s * outStride;
+    for (int x = 0; x < W; x++) {
+        for (int j = 0; j < s; j++) dst[x * s + j] = pixels[centre + x];
+    }
+    for (int i = 1; i < s; i++) std::copy_n(dst, outStride, dst + i * outStride);
+
+    for (int x = 0; x < W; x++) {
+        // With no neighbour differing, every case blends only the side
+        // neighbours in, which changes nothing if they match exactly
+        unsigned d = differ[x];
+        if (!d) continue;
+        Neighbourhood nb;
+        for (int n = 0; n < 9; n++) {
+            size_t p = centre + x + offsets[n];
+            nb.color[n] = pixels[p];
+            nb.luma[n] = luma[p]; nb.chromaB[n] = chromaB[p]; nb.chromaR[n] = chromaR[p];
+        }
+        HqRule rules[4];
+        for (int rot = 0; rot < 4; rot++) rules[rot] = hqRules[hqPattern(d, turn[rot])];
+        for (int rot = 0; rot < 4; rot++) {
+            Block block{ dst + x * s, outStride, s, rot };
+            if (s == 2) {
+                block.at(0, 0) = hq2xCorner(nb, turn[rot], rules[rot]);
+            } else {
+                // The view turned three times has this view's top-right corner at its top left
+                block.at(0, 0) = hq3xCorner(nb, turn[rot], rules[rot]);
+                block.at(0, 1) = hq3xEdge(nb, turn[rot], d, rules[rot], rules[(rot + 3) % 4]);
+            }
+        }
+    }
+}
+
+void Upscaler::scaleXbrz(int row, uint32_t* out) const {
+    const int s = factor, outStride = W * s;
+    const size_t centre = (size_t)(row + PAD) * STRIDE + PAD;
+    const int offsets[9] = { -STRIDE - 1, -STRIDE, -STRIDE + 1, -1, 0, 1, STRIDE - 1, STRIDE, STRIDE + 1 };
+
+    uint32_t* dst = out + (size_t)row * s * outStride;
+    for (int x = 0; x < W; x++) {
+        for (int j = 0; j < s; j++) dst[x * s + j] = pixels[centre + x];
+    }
+    for (int i = 1; i < s; i++) std::copy_n(dst, outStride, dst + i * outStride);
+
+    // The pixel's corners, from the four blocks it belongs to
+    const uint8_t* above = corners.data() + (size_t)row * (W + 1);
+    const uint8_t* below = above + (W + 1);
+    for (int x = 0; x < W; x++) {
+        uint8_t blendInfo = (uint8_t)(((above[x] >> 6) & 3) | (((above[x + 1] >> 4) & 3) << 2) |
+                                      ((below[x + 1] & 3) << 4) | (((below[x] >> 2) & 3) << 6));
+        if (!blendInfo) continue;
+        Neighbourhood nb;
+        for (int n = 0; n < 9; n++) {
+            size_t p = centre + x + offsets[n];
+            nb.color[n] = pixels[p];
+            nb.luma[n] = luma[p]; nb.chromaB[n] = chromaB[p]; nb.chromaR[n] = chromaR[p];
+        }
+        for (int rot = 0; rot < 4; rot++) {
+            Block block{ dst + x * s, outStride, s, rot };
+            switch (s) {
+            case 2: xbrzBlend<2>(nb, block, blendInfo); break;
+            case 3: xbrzBlend<3>(nb, block, blendInfo); break;
+            default: xbrzBlend<4>(nb, block, blendInfo); break;
+            }
+        }
+    }
+}
+
+void Upscaler::upscale(const uint32_t* in, uint32_t* out) {
+    // fn(begin, end) for each band of rows
+    auto bands = [&](int rows, auto&& fn) {
+        pool.parallelFor((size_t)(rows + LINES_PER_BAND - 1) / LINES_PER_BAND, [&](size_t band) {
+            int begin = (int)band * LINES_PER_BAND;
+            fn(begin, std::min(rows, begin + LINES_PER_BAND));
+        });
+    };
+
+    bands(ROWS, [&](int begin, int end) {
+        for (int row = begin; row < end; row++) preparePlanes(in, row);
+    });
+    if (filter == Filter::Hq2x || filter == Filter::Hq3x) {
+        bands(H, [&](int begin, int end) {
+            for (int row = begin; row < end; row++) scaleHq(row, out);
+        });
+    } else {
+        bands(H + 1, [&](int begin, int end) { classifyCorners(begin, end); });
+        bands(H, [&](int begin, int end) {
+            for (int row = begin; row < end; row++) scaleXbrz(row, out);
+        });
+    }
+}
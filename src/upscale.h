@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "threadpool.h"
+
+// Pixel-art upscalers for a 256x240 ARGB frame (expandFrame()'s output):
+// edge-directed filters that round off diagonal staircases while keeping
+// straight edges sharp, unlike the renderer's nearest/linear scaling.
+//
+//   hq2x, hq3x     HQx: which of the 8 neighbours differ from the pixel
+//                  (hqx's YUV thresholds) picks one of hqx's 256 cases, a
+//                  fixed blend for each output pixel
+//   xbrz2 - xbrz4  xBRZ: corners are classified on a 4x4 kernel by comparing
+//                  colour gradients along both diagonals, then blended as
+//                  shallow, steep or 45-degree lines
+//
+// A frame goes through in stages, each split into bands of lines across a
+// thread pool: edge-padded pixels and colour-space planes, then (xBRZ) the
+// per-corner blend decisions, then the output blocks. The colour-distance
+// and gradient work runs over whole rows so the compiler vectorizes it;
+// only pixels near edges take the per-pixel blending path.
+class Upscaler {
+public:
+    enum class Filter { Hq2x, Hq3x, Xbrz2, Xbrz3, Xbrz4 };
+
+    static constexpr int WIDTH = 256;
+    static constexpr int HEIGHT = 240;
+
+    explicit Upscaler(Filter filter, int threads = 0); // 0 = one per hardware thread
+
+    // "hq2x", "hq3x", "xbrz2", "xbrz3" or "xbrz4"; false for anything else
+    static bool parse(const std::string& name, Filter& filter);
+
+    int scale() const { return factor; }
+
+    // WIDTH x HEIGHT ARGB in, (WIDTH * scale()) x (HEIGHT * scale()) ARGB out
+    void upscale(const uint32_t* in, uint32_t* out);
+
+private:
+    Filter filter;
+    int factor;
+    ThreadPool pool;
+
+    // The frame with a border of repeated edge pixels, and each pixel in the
+    // filter's colour space (YUV for HQx, YCbCr for xBRZ) as three planes
+    std::vector<uint32_t> pixels;
+    std::vector<float> luma, chromaB, chromaR;
+    float toLuma[3], toChromaB[3], toChromaR[3]; // xBRZ, from R, G, B
+
+    // xBRZ: the blend level of the four corners meeting at the centre of
+    // each 2x2 block of pixels, (WIDTH + 1) x (HEIGHT + 1) blocks
+    std::vector<uint8_t> corners;
+
+    void preparePlanes(const uint32_t* in, int row);
+    void classifyCorners(int begin, int end); // rows of blocks
+    void classifyRow(int row, const float* main0, const float* main1, const float* main2,
+                     const float* anti0, const float* anti1, const float* anti2);
+    void scaleHq(int row, uint32_t* out) const;
+    void scaleXbrz(int row, uint32_t* out) const;
+};